@@ -17,9 +17,68 @@
 // Math.h - STD math Library
 #include <math.h>
 
+// String View - STD Non-owning String Library
+#include <string_view>
+
+// CString - STD C String Library
+#include <cstring>
+
+// CStdLib - STD C General Utilities Library
+#include <cstdlib>
+
+// CharConv - STD Number Conversion Library
+#include <charconv>
+
+// Algorithm - STD Algorithm Library
+#include <algorithm>
+
+// Thread - STD Thread Library
+#include <thread>
+
+// Unordered Map - STD Hash Map Library
+#include <unordered_map>
+
+// Functional - STD Function Object Library
+#include <functional>
+
+// CStdInt - STD Fixed Width Integer Library
+#include <cstdint>
+
+// CStdIO - STD C File Library
+#include <cstdio>
+
+// Filesystem - STD Path Library
+#include <filesystem>
+
+// Platform File Mapping
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // Print progress to console while loading (large models)
 //#define OBJL_CONSOLE_OUTPUT
 
+// Time the triangulation done by LoadFile (benchmarks)
+//#define OBJL_PROFILE
+
+#ifdef OBJL_PROFILE
+#include <chrono>
+#endif
+
 // Namespace: OBJL
 //
 // Description: The namespace that holds eveyrthing that
@@ -191,18 +250,29 @@ namespace objl
 	//
 	// Description: A Simple Mesh Object that holds
 	//	a name, a vertex list, and an index list
+	//
+	//	When loaded with shared storage the lists stay
+	//	empty and the mesh is only a range of the
+	//	loader's LoadedVertices and LoadedIndices
 	struct Mesh
 	{
 		// Default Constructor
 		Mesh()
 		{
-
+			VertexOffset = 0;
+			VertexCount = 0;
+			IndexOffset = 0;
+			IndexCount = 0;
 		}
 		// Variable Set Constructor
 		Mesh(std::vector<Vertex>& _Vertices, std::vector<unsigned int>& _Indices)
 		{
 			Vertices = _Vertices;
 			Indices = _Indices;
+			VertexOffset = 0;
+			VertexCount = 0;
+			IndexOffset = 0;
+			IndexCount = 0;
 		}
 		// Mesh Name
 		std::string MeshName;
@@ -211,6 +281,15 @@ namespace objl
 		// Index List
 		std::vector<unsigned int> Indices;
 
+		// Vertex Range in LoadedVertices
+		//	(LoadFileMapped and LoadFileParallel only)
+		size_t VertexOffset;
+		size_t VertexCount;
+		// Index Range in LoadedIndices
+		//	(LoadFileMapped and LoadFileParallel only)
+		size_t IndexOffset;
+		size_t IndexCount;
+
 		// Material
 		Material MeshMaterial;
 	};
@@ -404,8 +483,378 @@ namespace objl
 				idx--;
 			return elements[idx];
 		}
+
+		// Get first token of a string view
+		inline std::string_view firstTokenView(std::string_view in)
+		{
+			size_t token_start = in.find_first_not_of(" \t");
+			if (token_start == std::string_view::npos)
+				return std::string_view();
+			size_t token_end = in.find_first_of(" \t", token_start);
+			if (token_end == std::string_view::npos)
+				return in.substr(token_start);
+			return in.substr(token_start, token_end - token_start);
+		}
+
+		// Get tail of a string view after first token and possibly following spaces
+		inline std::string_view tailView(std::string_view in)
+		{
+			size_t token_start = in.find_first_not_of(" \t");
+			size_t space_start = in.find_first_of(" \t", token_start);
+			size_t tail_start = in.find_first_not_of(" \t", space_start);
+			size_t tail_end = in.find_last_not_of(" \t");
+			if (tail_start != std::string_view::npos && tail_end != std::string_view::npos)
+			{
+				return in.substr(tail_start, tail_end - tail_start + 1);
+			}
+			else if (tail_start != std::string_view::npos)
+			{
+				return in.substr(tail_start);
+			}
+			return std::string_view();
+		}
+
+		// Pop the next space separated token off the front of a string view
+		inline std::string_view nextToken(std::string_view &in)
+		{
+			size_t token_start = in.find_first_not_of(" \t");
+			if (token_start == std::string_view::npos)
+			{
+				in = std::string_view();
+				return std::string_view();
+			}
+			size_t token_end = in.find_first_of(" \t", token_start);
+			if (token_end == std::string_view::npos)
+				token_end = in.size();
+			std::string_view token = in.substr(token_start, token_end - token_start);
+			in.remove_prefix(token_end);
+			return token;
+		}
+
+		// Get the next line of a mapped buffer without its
+		//	line ending and advance the cursor past it
+		inline std::string_view nextLine(const char* &cursor, const char* end)
+		{
+			const char* eol = (const char*)memchr(cursor, '\n', end - cursor);
+			if (eol == NULL)
+				eol = end;
+
+			std::string_view line(cursor, eol - cursor);
+			cursor = eol < end ? eol + 1 : end;
+
+			if (!line.empty() && line.back() == '\r')
+				line.remove_suffix(1);
+			return line;
+		}
+
+		// Run a function for every chunk index, each on its own thread
+		template <class F>
+		inline void parallelChunks(size_t count, F fn)
+		{
+			std::vector<std::thread> workers;
+			for (size_t c = 1; c < count; c++)
+			{
+				workers.emplace_back(fn, c);
+			}
+			if (count > 0)
+				fn(0);
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+		}
+
+		// Parse a float after any leading spaces and advance the
+		//	cursor past it
+		//
+		// Uses std::from_chars, which is locale independent,
+		// never allocates and rounds exactly like std::stof
+		inline bool parseFloat(const char* &cursor, const char* end, float &out)
+		{
+			while (cursor < end && (*cursor == ' ' || *cursor == '\t'))
+				cursor++;
+
+			const char* start = cursor;
+			if (start < end && *start == '+')
+				start++;
+
+			std::from_chars_result result = std::from_chars(start, end, out);
+			if (result.ec != std::errc())
+				return false;
+
+			cursor = result.ptr;
+			return true;
+		}
+
+		// Parse up to count space separated floats from a string
+		//	view, return how many were parsed
+		inline int parseFloats(std::string_view in, float* out, int count)
+		{
+			const char* cursor = in.data();
+			const char* end = cursor + in.size();
+
+			int parsed = 0;
+			while (parsed < count && parseFloat(cursor, end, out[parsed]))
+				parsed++;
+			return parsed;
+		}
+
+		// Parse a float from a string view without allocating
+		inline float parseFloatView(std::string_view in)
+		{
+			float value = 0.0f;
+			const char* cursor = in.data();
+			parseFloat(cursor, cursor + in.size(), value);
+			return value;
+		}
+
+		// Parse a signed integer from a string view without allocating
+		inline int parseIntView(std::string_view in)
+		{
+			const char* start = in.data();
+			const char* end = start + in.size();
+			if (start < end && *start == '+')
+				start++;
+
+			int value = 0;
+			std::from_chars(start, end, value);
+			return value;
+		}
+
+		// Get the zero based position of an index, where count is the
+		//	number of elements that were defined before the face
+		inline int resolveIndexView(size_t count, std::string_view index)
+		{
+			int idx = parseIntView(index);
+			if (idx < 0)
+				idx = int(count) + idx;
+			else
+				idx--;
+			return idx;
+		}
+	}
+
+	// Allocate memory aligned to the given number of bytes
+	//	(64 by default), release it with AlignedFree
+	inline void* AlignedAlloc(size_t bytes, size_t alignment = 64)
+	{
+		if (bytes == 0)
+			bytes = alignment;
+		#ifdef _WIN32
+		return _aligned_malloc(bytes, alignment);
+		#else
+		void* memory = NULL;
+		if (posix_memalign(&memory, alignment, bytes) != 0)
+			return NULL;
+		return memory;
+		#endif
+	}
+
+	// Release memory from AlignedAlloc
+	inline void AlignedFree(void* memory)
+	{
+		#ifdef _WIN32
+		_aligned_free(memory);
+		#else
+		free(memory);
+		#endif
+	}
+
+	// Id of the running process, for names of temporary files
+	//	that concurrent processes must not share
+	inline unsigned long ProcessId()
+	{
+		#ifdef _WIN32
+		return (unsigned long)GetCurrentProcessId();
+		#else
+		return (unsigned long)getpid();
+		#endif
 	}
 
+	// Structure: BufferSink
+	//
+	// Description: Caller provided arrays that Loader::LoadFileInto
+	//	writes vertex positions and triangle indices into,
+	//	instead of LoadedVertices and LoadedIndices
+	//
+	//	Strides are counted in elements, so an array of
+	//	cl_float3/cl_uint4 (stride 4) or separate X, Y and
+	//	Z arrays (stride 1) can be filled directly
+	struct BufferSink
+	{
+		// Default Constructor
+		BufferSink()
+		{
+			X = NULL;
+			Y = NULL;
+			Z = NULL;
+			PositionStride = 1;
+			Triangles = NULL;
+			TriangleStride = 3;
+		}
+
+		// Called once the vertex and triangle counts are known,
+		//	must point the arrays below at enough memory
+		//
+		// Return false to abort the load
+		std::function<bool(BufferSink& sink, size_t vertexCount, size_t triangleCount)> Allocate;
+
+		// Vertex Position Components
+		float* X;
+		float* Y;
+		float* Z;
+		size_t PositionStride;
+
+		// Triangle Vertex Indices, a fourth
+		//	component is set to 0 when the stride allows
+		unsigned int* Triangles;
+		size_t TriangleStride;
+	};
+
+	// Structure: TriangleBatch
+	//
+	// Description: A batch of triangles streamed by
+	//	Loader::StreamFile, with the positions of the
+	//	vertices they use
+	struct TriangleBatch
+	{
+		// Default Constructor
+		TriangleBatch()
+		{
+			FirstTriangle = 0;
+		}
+
+		// Positions of the batch vertices
+		std::vector<Vector3> Positions;
+		// Batch vertex indices, three per triangle
+		std::vector<unsigned int> Indices;
+		// Zero based v line of every batch vertex
+		std::vector<size_t> PositionIds;
+		// Number of triangles streamed before this batch
+		size_t FirstTriangle;
+	};
+
+	// Class: MappedFile
+	//
+	// Description: A read-only memory mapping of a whole file
+	//	so that it can be tokenized in place without copying
+	class MappedFile
+	{
+	public:
+		// Default Constructor
+		MappedFile()
+		{
+
+		}
+		~MappedFile()
+		{
+			Close();
+		}
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// Map a file into memory
+		//
+		// If the file is mapped return true
+		//
+		// If the file is unable to be opened, is
+		// empty or unable to be mapped return false
+		bool Open(const std::string& Path)
+		{
+			Close();
+
+			#ifdef _WIN32
+			file = CreateFileA(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+				OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				Close();
+				return false;
+			}
+
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL)
+			{
+				Close();
+				return false;
+			}
+
+			data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (data == NULL)
+			{
+				Close();
+				return false;
+			}
+			size = (size_t)fileSize.QuadPart;
+			#else
+			int fd = open(Path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+
+			struct stat fileStat;
+			if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+			{
+				close(fd);
+				return false;
+			}
+
+			void* view = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (view == MAP_FAILED)
+				return false;
+
+			madvise(view, (size_t)fileStat.st_size, MADV_SEQUENTIAL);
+			data = (const char*)view;
+			size = (size_t)fileStat.st_size;
+			#endif
+
+			return true;
+		}
+
+		// Unmap the file
+		void Close()
+		{
+			#ifdef _WIN32
+			if (data != NULL)
+				UnmapViewOfFile(data);
+			if (mapping != NULL)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+			#else
+			if (data != NULL)
+				munmap((void*)data, size);
+			#endif
+			data = NULL;
+			size = 0;
+		}
+
+		// Mapped bytes
+		const char* Data() const
+		{
+			return data;
+		}
+		// Number of mapped bytes
+		size_t Size() const
+		{
+			return size;
+		}
+
+	private:
+		const char* data = NULL;
+		size_t size = 0;
+		#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+		#endif
+	};
+
 	// Class: Loader
 	//
 	// Description: The OBJ Model Loader
@@ -415,7 +864,13 @@ namespace objl
 		// Default Constructor
 		Loader()
 		{
-
+			WeldVertices = false;
+			SharedStorage = false;
+			UseBinaryCache = false;
+			ScratchDirectory.clear();
+			#ifdef OBJL_PROFILE
+			ProfileTriangulation = 0.0;
+			#endif
 		}
 		~Loader()
 		{
@@ -444,6 +899,10 @@ namespace objl
 			LoadedVertices.clear();
 			LoadedIndices.clear();
 
+			#ifdef OBJL_PROFILE
+			ProfileTriangulation = 0.0;
+			#endif
+
 			std::vector<Vector3> Positions;
 			std::vector<Vector2> TCoords;
 			std::vector<Vector3> Normals;
@@ -590,8 +1049,17 @@ namespace objl
 
 					std::vector<unsigned int> iIndices;
 
+					#ifdef OBJL_PROFILE
+					auto triangulationStart = std::chrono::steady_clock::now();
+					#endif
+
 					VertexTriangluation(iIndices, vVerts);
 
+					#ifdef OBJL_PROFILE
+					ProfileTriangulation += std::chrono::duration<double>(
+						std::chrono::steady_clock::now() - triangulationStart).count();
+					#endif
+
 					// Add Indices
 					for (int i = 0; i < int(iIndices.size()); i++)
 					{
@@ -712,104 +1180,1768 @@ namespace objl
 			}
 		}
 
-		// Loaded Mesh Objects
-		std::vector<Mesh> LoadedMeshes;
-		// Loaded Vertex Objects
-		std::vector<Vertex> LoadedVertices;
-		// Loaded Index Positions
-		std::vector<unsigned int> LoadedIndices;
-		// Loaded Material Objects
-		std::vector<Material> LoadedMaterials;
-
-	private:
-		// Generate vertices from a list of positions, 
-		//	tcoords, normals and a face line
-		void GenVerticesFromRawOBJ(std::vector<Vertex>& oVerts,
-			const std::vector<Vector3>& iPositions,
-			const std::vector<Vector2>& iTCoords,
-			const std::vector<Vector3>& iNormals,
-			std::string icurline)
+		// Load a file into the loader through a memory mapping
+		//
+		// Produces the same output as LoadFile, but tokenizes
+		// the mapped file in place with string views so no
+		// heap allocation is made per line, and triangulates
+		// concave faces correctly (see TriangulateFace)
+		//
+		// If file is loaded return true
+		//
+		// If the file is unable to be found
+		// or unable to be loaded return false
+		bool LoadFileMapped(std::string Path)
 		{
-			std::vector<std::string> sface, svert;
-			Vertex vVert;
-			algorithm::split(algorithm::tail(icurline), sface, " ");
+			// If the file is not an .obj file return false
+			if (Path.size() < 4 || Path.substr(Path.size() - 4, 4) != ".obj")
+				return false;
 
-			bool noNormal = false;
+			// Skip parsing while the binary cache is valid
+			if (UseBinaryCache && LoadCache(Path, NULL))
+				return true;
 
-			// For every given vertex do this
-			for (int i = 0; i < int(sface.size()); i++)
-			{
-				// See What type the vertex is.
-				int vtype;
+			MappedFile file;
 
-				algorithm::split(sface[i], svert, "/");
+			if (!file.Open(Path))
+				return false;
 
-				// Check for just position - v1
-				if (svert.size() == 1)
-				{
-					// Only position
-					vtype = 1;
-				}
+			LoadedMeshes.clear();
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			LoadedMaterials.clear();
+			MaterialLibraries.clear();
 
-				// Check for position & texture - v1/vt1
-				if (svert.size() == 2)
-				{
-					// Position & Texture
-					vtype = 2;
-				}
+			std::vector<Vector3> Positions;
+			std::vector<Vector2> TCoords;
+			std::vector<Vector3> Normals;
 
-				// Check for Position, Texture and Normal - v1/vt1/vn1
-				// or if Position and Normal - v1//vn1
-				if (svert.size() == 3)
-				{
-					if (svert[1] != "")
-					{
-						// Position, Texture, and Normal
-						vtype = 4;
-					}
-					else
-					{
-						// Position & Normal
-						vtype = 3;
-					}
-				}
+			MeshState meshes;
+			meshes.copyGeometry = !SharedStorage;
 
-				// Calculate and store the vertex
-				switch (vtype)
+			// Scratch buffers reused for every face
+			FaceScratch scratch;
+			WeldMap weld;
+
+			const char* cursor = file.Data();
+			const char* end = cursor + file.Size();
+
+			while (cursor < end)
+			{
+				std::string_view curline = algorithm::nextLine(cursor, end);
+
+				switch (LineType(curline))
 				{
-				case 1: // P
+				// Generate a Mesh Object or Prepare for an object to be created
+				case LINE_OBJECT:
 				{
-					vVert.Position = algorithm::getElement(iPositions, svert[0]);
-					vVert.TextureCoordinate = Vector2(0, 0);
-					noNormal = true;
-					oVerts.push_back(vVert);
+					BeginObject(meshes, curline, LoadedVertices.size(), LoadedIndices.size());
+					weld.clear();
 					break;
 				}
-				case 2: // P/T
+				// Generate a Vertex Position
+				case LINE_POSITION:
 				{
-					vVert.Position = algorithm::getElement(iPositions, svert[0]);
-					vVert.TextureCoordinate = algorithm::getElement(iTCoords, svert[1]);
-					noNormal = true;
-					oVerts.push_back(vVert);
+					Positions.push_back(ParseVector3(curline));
 					break;
 				}
-				case 3: // P//N
+				// Generate a Vertex Texture Coordinate
+				case LINE_TCOORD:
 				{
-					vVert.Position = algorithm::getElement(iPositions, svert[0]);
-					vVert.TextureCoordinate = Vector2(0, 0);
-					vVert.Normal = algorithm::getElement(iNormals, svert[2]);
-					oVerts.push_back(vVert);
+					TCoords.push_back(ParseVector2(curline));
 					break;
 				}
-				case 4: // P/T/N
+				// Generate a Vertex Normal
+				case LINE_NORMAL:
 				{
-					vVert.Position = algorithm::getElement(iPositions, svert[0]);
-					vVert.TextureCoordinate = algorithm::getElement(iTCoords, svert[1]);
-					vVert.Normal = algorithm::getElement(iNormals, svert[2]);
-					oVerts.push_back(vVert);
+					Normals.push_back(ParseVector3(curline));
 					break;
 				}
-				default:
+				// Generate a Face (vertices & indices)
+				case LINE_FACE:
+				{
+					AppendFace(scratch, LoadedVertices, LoadedIndices, WeldVertices ? &weld : NULL,
+						Positions, TCoords, Normals,
+						Positions.size(), TCoords.size(), Normals.size(),
+						algorithm::tailView(curline));
+					break;
+				}
+				// Get Mesh Material Name
+				case LINE_USEMTL:
+				{
+					BeginMaterial(meshes, curline, LoadedVertices.size(), LoadedIndices.size());
+					weld.clear();
+					break;
+				}
+				// Load Materials
+				case LINE_MTLLIB:
+				{
+					LoadMaterialLibrary(Path, curline);
+					break;
+				}
+				default:
+				{
+					break;
+				}
+				}
+			}
+
+			file.Close();
+
+			// Deal with last mesh and set Materials for each Mesh
+			FinishMeshes(meshes, LoadedVertices.size(), LoadedIndices.size());
+
+			if (LoadedMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty())
+				return false;
+
+			if (UseBinaryCache)
+				SaveCache(Path, NULL, LoadedVertices.size(), LoadedIndices.size());
+
+			return true;
+		}
+
+		// Load a file into the loader on several threads
+		//
+		// The mapped file is split into newline aligned
+		// chunks. Every chunk first parses its v/vt/vn
+		// records, a prefix sum over the chunks places them
+		// in the global attribute lists, then every chunk
+		// builds the vertices and indices of its faces and
+		// a second prefix sum stitches them together. Mesh
+		// boundaries are replayed in file order at the end,
+		// so the output is identical to LoadFileMapped
+		//
+		// ThreadCount of 0 uses every hardware thread
+		//
+		// If file is loaded return true
+		//
+		// If the file is unable to be found
+		// or unable to be loaded return false
+		bool LoadFileParallel(std::string Path, unsigned int ThreadCount = 0)
+		{
+			return LoadChunked(Path, ThreadCount, NULL);
+		}
+
+		// Load a file on several threads straight into the
+		//	arrays of a sink
+		//
+		// LoadedVertices and LoadedIndices stay empty and the
+		// loaded meshes are ranges of the sink arrays, so no
+		// copy of the geometry is kept by the loader
+		//
+		// ThreadCount of 0 uses every hardware thread
+		//
+		// If file is loaded return true
+		//
+		// If the file is unable to be found, unable
+		// to be loaded or the sink refuses to allocate
+		// return false
+		bool LoadFileInto(std::string Path, BufferSink& Sink, unsigned int ThreadCount = 0)
+		{
+			return LoadChunked(Path, ThreadCount, &Sink);
+		}
+
+		// Stream the triangles of a file to a callback in
+		//	batches of at most BatchTriangles triangles (a
+		//	single larger face gets a batch of its own)
+		//
+		// Only positions are read. They are first spilled to
+		// a scratch file of this process in ScratchDirectory
+		// and mapped, so the system can page
+		// them out, then the faces are triangulated in file
+		// order and every batch gets its own copy of the
+		// positions it uses. Memory use is bounded by the
+		// batch size however large the file is, and the
+		// loaded lists are left untouched
+		//
+		// Streaming stops when Consume returns false
+		//
+		// If the whole file is streamed return true
+		bool StreamFile(std::string Path, size_t BatchTriangles,
+			const std::function<bool(const TriangleBatch& batch)>& Consume)
+		{
+			// If the file is not an .obj file return false
+			if (Path.size() < 4 || Path.substr(Path.size() - 4, 4) != ".obj" || BatchTriangles == 0)
+				return false;
+
+			MappedFile file;
+
+			if (!file.Open(Path))
+				return false;
+
+			const char* begin = file.Data();
+			const char* end = begin + file.Size();
+
+			// Spill the positions to the scratch file, named
+			// after the process so concurrent runs on the same
+			// file keep apart, and away from the input, which
+			// may well be read-only
+			std::error_code error;
+			std::filesystem::path scratchDirectory = ScratchDirectory.empty()
+				? std::filesystem::temp_directory_path(error) : std::filesystem::path(ScratchDirectory);
+			if (error)
+				return false;
+			std::string scratchPath = (scratchDirectory / (std::filesystem::path(Path).filename().string()
+				+ "." + std::to_string(ProcessId()) + ".positions")).string();
+			std::ofstream scratchFile(scratchPath, std::ios::binary | std::ios::trunc);
+			if (!scratchFile.is_open())
+				return false;
+
+			std::vector<float> block;
+			size_t positionCount = 0;
+			for (const char* cursor = begin; cursor < end;)
+			{
+				std::string_view curline = algorithm::nextLine(cursor, end);
+				if (LineType(curline) != LINE_POSITION)
+					continue;
+
+				Vector3 position = ParseVector3(curline);
+				block.push_back(position.X);
+				block.push_back(position.Y);
+				block.push_back(position.Z);
+				positionCount++;
+
+				if (block.size() >= StreamBlockFloats)
+				{
+					scratchFile.write((const char*)block.data(), block.size() * sizeof(float));
+					block.clear();
+				}
+			}
+			scratchFile.write((const char*)block.data(), block.size() * sizeof(float));
+			scratchFile.close();
+			std::vector<float>().swap(block);
+
+			MappedFile positions;
+			auto finish = [&](bool result)
+			{
+				positions.Close();
+				std::remove(scratchPath.c_str());
+				return result;
+			};
+
+			if (!scratchFile || (positionCount > 0 && !positions.Open(scratchPath)))
+				return finish(false);
+
+			TriangleBatch batch;
+			std::unordered_map<unsigned int, unsigned int> batchVertex;
+			FaceScratch scratch;
+
+			// Hand out the batch and start the next one
+			auto flush = [&]()
+			{
+				bool more = batch.Indices.empty() || Consume(batch);
+				batch.FirstTriangle += batch.Indices.size() / 3;
+				batch.Positions.clear();
+				batch.Indices.clear();
+				batch.PositionIds.clear();
+				batchVertex.clear();
+				return more;
+			};
+
+			size_t seen = 0;
+			for (const char* cursor = begin; cursor < end;)
+			{
+				std::string_view curline = algorithm::nextLine(cursor, end);
+
+				int type = LineType(curline);
+				if (type == LINE_POSITION)
+					seen++;
+				if (type != LINE_FACE)
+					continue;
+
+				// Gather the face corners, skipping faces that
+				//	name positions which are not defined yet
+				scratch.vVerts.clear();
+				scratch.corners.clear();
+				bool defined = true;
+				std::string_view iface = algorithm::tailView(curline);
+				for (std::string_view svert = algorithm::nextToken(iface); !svert.empty();
+					svert = algorithm::nextToken(iface))
+				{
+					int index = algorithm::resolveIndexView(seen, svert.substr(0, svert.find('/')));
+					if (index < 0 || (size_t)index >= seen)
+					{
+						defined = false;
+						break;
+					}
+
+					float values[3];
+					memcpy(values, positions.Data() + (size_t)index * sizeof(values), sizeof(values));
+
+					Vertex vertex;
+					vertex.Position = Vector3(values[0], values[1], values[2]);
+					scratch.vVerts.push_back(vertex);
+					scratch.corners.push_back((unsigned int)index);
+				}
+				if (!defined)
+					continue;
+
+				scratch.iIndices.clear();
+				TriangulateFace(scratch.iIndices, scratch.vVerts, scratch);
+
+				// Faces are never split between batches
+				if (!batch.Indices.empty()
+					&& (batch.Indices.size() + scratch.iIndices.size()) / 3 > BatchTriangles)
+				{
+					if (!flush())
+						return finish(false);
+				}
+
+				for (unsigned int corner : scratch.iIndices)
+				{
+					unsigned int position = scratch.corners[corner];
+					auto found = batchVertex.emplace(position, (unsigned int)batch.Positions.size());
+					if (found.second)
+					{
+						batch.Positions.push_back(scratch.vVerts[corner].Position);
+						batch.PositionIds.push_back(position);
+					}
+					batch.Indices.push_back(found.first->second);
+				}
+			}
+
+			return finish(flush());
+		}
+
+		// Loaded Mesh Objects
+		std::vector<Mesh> LoadedMeshes;
+		// Loaded Vertex Objects
+		std::vector<Vertex> LoadedVertices;
+		// Loaded Index Positions
+		std::vector<unsigned int> LoadedIndices;
+		// Loaded Material Objects
+		std::vector<Material> LoadedMaterials;
+
+		// Share one vertex between the face corners of a mesh that
+		//	use the same position, texture and normal indices
+		//	(LoadFileMapped and LoadFileParallel only)
+		//
+		// A corner without a normal index gets the face normal
+		// of the first face that used its vertex
+		bool WeldVertices;
+
+		// Keep the geometry only in LoadedVertices and
+		//	LoadedIndices and make every loaded mesh a range
+		//	of them instead of a copy
+		//	(LoadFileMapped and LoadFileParallel only)
+		bool SharedStorage;
+
+		// Keep a binary copy of the loaded meshes next to the
+		//	.obj file (Path + ".cache") and load from its memory
+		//	mapping instead of parsing while the .obj file, its
+		//	material libraries and WeldVertices are unchanged
+		//	(LoadFileMapped, LoadFileParallel and LoadFileInto only)
+		//
+		// A cache written by LoadFileInto only holds positions,
+		// it is replaced the next time full vertices are loaded
+		bool UseBinaryCache;
+
+		// Directory StreamFile spills positions to, the
+		//	system temporary directory when empty
+		std::string ScratchDirectory;
+
+		#ifdef OBJL_PROFILE
+		// Seconds the last LoadFile spent triangulating faces
+		double ProfileTriangulation;
+		#endif
+
+		// Get the vertices of a mesh, from the mesh itself
+		//	or from the shared vertex list
+		const Vertex* MeshVertices(const Mesh& mesh) const
+		{
+			if (!mesh.Vertices.empty())
+				return mesh.Vertices.data();
+			return LoadedVertices.data() + mesh.VertexOffset;
+		}
+
+		// Get index i of a mesh, relative to its first vertex
+		unsigned int MeshIndex(const Mesh& mesh, size_t i) const
+		{
+			if (!mesh.Indices.empty())
+				return mesh.Indices[i];
+			return LoadedIndices[mesh.IndexOffset + i] - (unsigned int)mesh.VertexOffset;
+		}
+
+	private:
+		// Record types of a line in an .obj file
+		enum
+		{
+			LINE_OTHER,
+			LINE_OBJECT,
+			LINE_POSITION,
+			LINE_TCOORD,
+			LINE_NORMAL,
+			LINE_FACE,
+			LINE_USEMTL,
+			LINE_MTLLIB
+		};
+
+		// Structure: MeshState
+		//
+		// Description: The object/group and material state
+		//	used to cut the loaded geometry into meshes
+		struct MeshState
+		{
+			// An o/g line has been seen
+			bool listening = false;
+			// Name of the mesh being built
+			std::string meshname;
+			// First vertex and index of the mesh being built
+			size_t vertexStart = 0;
+			size_t indexStart = 0;
+			// Material name of every usemtl line
+			std::vector<std::string> MeshMatNames;
+			// Copy the geometry of each mesh into it
+			bool copyGeometry = true;
+		};
+
+		// Structure: VertexKey
+		//
+		// Description: The position, texture and normal indices
+		//	of a face corner, -1 where the corner has none
+		struct VertexKey
+		{
+			int Position;
+			int TCoord;
+			int Normal;
+
+			bool operator==(const VertexKey& other) const
+			{
+				return Position == other.Position && TCoord == other.TCoord && Normal == other.Normal;
+			}
+		};
+
+		// Structure: VertexKeyHash
+		//
+		// Description: Hash of a VertexKey for the weld map
+		struct VertexKeyHash
+		{
+			size_t operator()(const VertexKey& key) const
+			{
+				size_t hash = (size_t)(unsigned int)key.Position * 0x9E3779B97F4A7C15ull;
+				hash ^= (size_t)(unsigned int)key.TCoord * 0xC2B2AE3D27D4EB4Full + (hash >> 29);
+				hash ^= (size_t)(unsigned int)key.Normal * 0x165667B19E3779F9ull + (hash >> 32);
+				return hash;
+			}
+		};
+
+		// Welded vertex of every corner key in the current weld scope
+		typedef std::unordered_map<VertexKey, unsigned int, VertexKeyHash> WeldMap;
+
+		// Structure: FaceScratch
+		//
+		// Description: Buffers reused for every face line
+		struct FaceScratch
+		{
+			std::vector<Vertex> vVerts;
+			std::vector<VertexKey> vKeys;
+			std::vector<unsigned int> iIndices;
+			std::vector<unsigned int> corners;
+
+			// Ear clipping state: projected corners, ring
+			//	links, reflex flags and the reflex corner grid
+			std::vector<float> u, v;
+			std::vector<unsigned int> prev, next;
+			std::vector<char> reflex;
+			std::vector<unsigned int> cellStart, cellItems;
+		};
+
+		// Structure: LoadEvent
+		//
+		// Description: A mesh or material line seen by a chunk,
+		//	with the chunk vertex and index counts at that line
+		struct LoadEvent
+		{
+			int Type;
+			std::string_view Line;
+			size_t VertexCount;
+			size_t IndexCount;
+		};
+
+		// Structure: LoadChunk
+		//
+		// Description: A newline aligned slice of a mapped
+		//	file and everything parsed from it by one thread
+		struct LoadChunk
+		{
+			const char* Begin = NULL;
+			const char* End = NULL;
+
+			// Attributes defined in this chunk and
+			//	the number defined before it
+			std::vector<Vector3> Positions;
+			std::vector<Vector2> TCoords;
+			std::vector<Vector3> Normals;
+			size_t PositionOffset = 0;
+			size_t TCoordOffset = 0;
+			size_t NormalOffset = 0;
+
+			// Face vertices and indices relative to the first
+			//	vertex of the chunk, and their global offsets
+			std::vector<Vertex> Vertices;
+			std::vector<unsigned int> Indices;
+			size_t VertexOffset = 0;
+			size_t IndexOffset = 0;
+
+			// Mesh and material lines in file order
+			std::vector<LoadEvent> Events;
+
+			// Welding: the chunk starts a new weld scope (o/g or
+			//	usemtl line) after LeadCount vertices, the keys of
+			//	those leading vertices, the weld map of the scope
+			//	the chunk ends in, the chunk and vertex each
+			//	leading vertex merges with, and its global index
+			bool WeldBreak = false;
+			size_t LeadCount = 0;
+			std::vector<VertexKey> LeadKeys;
+			WeldMap WeldTail;
+			std::vector<std::pair<size_t, unsigned int>> LeadTargets;
+			std::vector<unsigned int> LeadRemap;
+			size_t DroppedCount = 0;
+		};
+
+		// Chunks smaller than this are not worth a thread
+		static const size_t MinChunkBytes = 1 << 20;
+
+		// Floats written to the streaming scratch file at once
+		static const size_t StreamBlockFloats = 3 << 16;
+
+		// Structure: CacheHeader
+		//
+		// Description: Start of a binary cache file, followed
+		//	by the table section (source path, material
+		//	libraries, materials and meshes) padded to 8
+		//	bytes, the vertex records and the indices
+		//
+		//	Written in the byte order of the machine, a cache
+		//	from another platform fails validation and is
+		//	rebuilt
+		struct CacheHeader
+		{
+			char Magic[8];
+			uint32_t Version;
+			uint32_t Welded;
+			uint64_t SourceSize;
+			int64_t SourceTime;
+			uint64_t VertexCount;
+			uint32_t VertexBytes;
+			uint32_t Reserved;
+			uint64_t IndexCount;
+			uint64_t TableBytes;
+		};
+
+		// Structure: CacheReader
+		//
+		// Description: Bounds checked reads from the table
+		//	section of a mapped binary cache
+		struct CacheReader
+		{
+			CacheReader(const char* begin, const char* end)
+			{
+				at = begin;
+				this->end = end;
+				ok = true;
+			}
+
+			template <class T>
+			T Read()
+			{
+				T value = T();
+				if (!ok || (size_t)(end - at) < sizeof(T))
+				{
+					ok = false;
+					return value;
+				}
+				memcpy(&value, at, sizeof(T));
+				at += sizeof(T);
+				return value;
+			}
+
+			std::string ReadString()
+			{
+				uint32_t length = Read<uint32_t>();
+				if (!ok || (size_t)(end - at) < length)
+				{
+					ok = false;
+					return std::string();
+				}
+				std::string value(at, length);
+				at += length;
+				return value;
+			}
+
+			Vector3 ReadVector3()
+			{
+				float x = Read<float>();
+				float y = Read<float>();
+				float z = Read<float>();
+				return Vector3(x, y, z);
+			}
+
+			const char* at;
+			const char* end;
+			bool ok;
+		};
+
+		// Binary cache file identification
+		static constexpr char CacheMagic[8] = { 'O', 'B', 'J', 'L', 'B', 'I', 'N', 0 };
+		static const uint32_t CacheVersion = 1;
+
+		// Material library paths of the last load,
+		//	part of the binary cache key
+		std::vector<std::string> MaterialLibraries;
+
+		// Get the record type of a line
+		static int LineType(std::string_view curline)
+		{
+			std::string_view token = algorithm::firstTokenView(curline);
+
+			if (token == "o" || token == "g" || (!curline.empty() && curline[0] == 'g'))
+				return LINE_OBJECT;
+			if (token == "v")
+				return LINE_POSITION;
+			if (token == "vt")
+				return LINE_TCOORD;
+			if (token == "vn")
+				return LINE_NORMAL;
+			if (token == "f")
+				return LINE_FACE;
+			if (token == "usemtl")
+				return LINE_USEMTL;
+			if (token == "mtllib")
+				return LINE_MTLLIB;
+			return LINE_OTHER;
+		}
+
+		// Parse the three values of a v or vn line
+		static Vector3 ParseVector3(std::string_view curline)
+		{
+			float values[3] = { 0.0f, 0.0f, 0.0f };
+			algorithm::nextToken(curline);
+			algorithm::parseFloats(curline, values, 3);
+
+			return Vector3(values[0], values[1], values[2]);
+		}
+
+		// Parse the two values of a vt line
+		static Vector2 ParseVector2(std::string_view curline)
+		{
+			float values[2] = { 0.0f, 0.0f };
+			algorithm::nextToken(curline);
+			algorithm::parseFloats(curline, values, 2);
+
+			return Vector2(values[0], values[1]);
+		}
+
+		// Handle an o/g line at the given vertex and index counts
+		void BeginObject(MeshState& state, std::string_view curline, size_t vertexCount, size_t indexCount)
+		{
+			std::string_view token = algorithm::firstTokenView(curline);
+			bool named = token == "o" || token == "g";
+
+			if (!state.listening)
+			{
+				state.listening = true;
+				state.meshname = named ? algorithm::tailView(curline) : "unnamed";
+			}
+			else if (indexCount > state.indexStart && vertexCount > state.vertexStart)
+			{
+				// Generate the mesh to put into the array
+				EmitMesh(state.meshname, state, vertexCount, indexCount);
+				state.meshname = algorithm::tailView(curline);
+			}
+			else
+			{
+				state.meshname = named ? algorithm::tailView(curline) : "unnamed";
+			}
+		}
+
+		// Handle a usemtl line at the given vertex and index counts
+		void BeginMaterial(MeshState& state, std::string_view curline, size_t vertexCount, size_t indexCount)
+		{
+			state.MeshMatNames.push_back(std::string(algorithm::tailView(curline)));
+
+			// Create new Mesh, if Material changes within a group
+			if (indexCount > state.indexStart && vertexCount > state.vertexStart)
+			{
+				// Same naming as LoadFile
+				EmitMesh(state.meshname + "_2", state, vertexCount, indexCount);
+			}
+		}
+
+		// Emit the last mesh and set Materials for each Mesh
+		void FinishMeshes(MeshState& state, size_t vertexCount, size_t indexCount)
+		{
+			if (indexCount > state.indexStart && vertexCount > state.vertexStart)
+			{
+				EmitMesh(state.meshname, state, vertexCount, indexCount);
+			}
+
+			AssignMeshMaterials(state.MeshMatNames);
+		}
+
+		// Create a mesh from the loaded vertices and indices
+		//	between the mesh start and the given counts
+		void EmitMesh(const std::string& name, MeshState& state, size_t vertexEnd, size_t indexEnd)
+		{
+			Mesh tempMesh;
+			tempMesh.MeshName = name;
+			tempMesh.VertexOffset = state.vertexStart;
+			tempMesh.VertexCount = vertexEnd - state.vertexStart;
+			tempMesh.IndexOffset = state.indexStart;
+			tempMesh.IndexCount = indexEnd - state.indexStart;
+
+			if (state.copyGeometry)
+				CopyMeshGeometry(tempMesh);
+
+			LoadedMeshes.push_back(std::move(tempMesh));
+
+			state.vertexStart = vertexEnd;
+			state.indexStart = indexEnd;
+		}
+
+		// Copy the range of a mesh out of the loaded
+		//	vertices and indices into the mesh itself
+		void CopyMeshGeometry(Mesh& mesh)
+		{
+			mesh.Vertices.assign(LoadedVertices.begin() + mesh.VertexOffset,
+				LoadedVertices.begin() + mesh.VertexOffset + mesh.VertexCount);
+			mesh.Indices.reserve(mesh.IndexCount);
+			for (size_t i = mesh.IndexOffset; i < mesh.IndexOffset + mesh.IndexCount; i++)
+			{
+				mesh.Indices.push_back(LoadedIndices[i] - (unsigned int)mesh.VertexOffset);
+			}
+		}
+
+		// Load the materials of a mtllib line, relative
+		//	to the directory of the .obj file
+		void LoadMaterialLibrary(const std::string& Path, std::string_view curline)
+		{
+			std::string pathtomat = Path.substr(0, Path.find_last_of('/') + 1);
+
+			pathtomat += algorithm::tailView(curline);
+
+			MaterialLibraries.push_back(pathtomat);
+			LoadMaterials(pathtomat);
+		}
+
+		// Copy the loaded material matching each usemtl
+		//	name into the mesh with the same position
+		void AssignMeshMaterials(const std::vector<std::string>& MeshMatNames)
+		{
+			for (size_t i = 0; i < MeshMatNames.size() && i < LoadedMeshes.size(); i++)
+			{
+				for (size_t j = 0; j < LoadedMaterials.size(); j++)
+				{
+					if (LoadedMaterials[j].name == MeshMatNames[i])
+					{
+						LoadedMeshes[i].MeshMaterial = LoadedMaterials[j];
+						break;
+					}
+				}
+			}
+		}
+
+		// Load a file on several threads into the loaded lists,
+		//	or into the arrays of a sink when one is given
+		bool LoadChunked(const std::string& Path, unsigned int ThreadCount, BufferSink* sink)
+		{
+			// If the file is not an .obj file return false
+			if (Path.size() < 4 || Path.substr(Path.size() - 4, 4) != ".obj")
+				return false;
+
+			// Skip parsing while the binary cache is valid
+			if (UseBinaryCache && LoadCache(Path, sink))
+				return true;
+
+			MappedFile file;
+
+			if (!file.Open(Path))
+				return false;
+
+			LoadedMeshes.clear();
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			LoadedMaterials.clear();
+			MaterialLibraries.clear();
+
+			std::vector<LoadChunk> chunks;
+			SplitChunks(chunks, file.Data(), file.Size(), ThreadCount);
+
+			// Parse the attribute records of every chunk
+			algorithm::parallelChunks(chunks.size(), [&](size_t c)
+			{
+				ParseChunkAttributes(chunks[c]);
+			});
+
+			// Place the chunk attributes in the global lists
+			std::vector<Vector3> Positions;
+			std::vector<Vector2> TCoords;
+			std::vector<Vector3> Normals;
+
+			size_t positionCount = 0, tcoordCount = 0, normalCount = 0;
+			for (LoadChunk& chunk : chunks)
+			{
+				chunk.PositionOffset = positionCount;
+				chunk.TCoordOffset = tcoordCount;
+				chunk.NormalOffset = normalCount;
+				positionCount += chunk.Positions.size();
+				tcoordCount += chunk.TCoords.size();
+				normalCount += chunk.Normals.size();
+			}
+			Positions.resize(positionCount);
+			TCoords.resize(tcoordCount);
+			Normals.resize(normalCount);
+
+			algorithm::parallelChunks(chunks.size(), [&](size_t c)
+			{
+				LoadChunk& chunk = chunks[c];
+				std::copy(chunk.Positions.begin(), chunk.Positions.end(), Positions.begin() + chunk.PositionOffset);
+				std::copy(chunk.TCoords.begin(), chunk.TCoords.end(), TCoords.begin() + chunk.TCoordOffset);
+				std::copy(chunk.Normals.begin(), chunk.Normals.end(), Normals.begin() + chunk.NormalOffset);
+				std::vector<Vector3>().swap(chunk.Positions);
+				std::vector<Vector2>().swap(chunk.TCoords);
+				std::vector<Vector3>().swap(chunk.Normals);
+			});
+
+			// Generate the faces of every chunk
+			algorithm::parallelChunks(chunks.size(), [&](size_t c)
+			{
+				ParseChunkFaces(chunks[c], Positions, TCoords, Normals);
+			});
+
+			std::vector<Vector3>().swap(Positions);
+			std::vector<Vector2>().swap(TCoords);
+			std::vector<Vector3>().swap(Normals);
+
+			// Merge weld scopes that continue across chunk seams
+			if (WeldVertices)
+				WeldChunkSeams(chunks);
+
+			// Stitch the chunk vertices and indices together
+			size_t vertexCount = 0, indexCount = 0;
+			for (LoadChunk& chunk : chunks)
+			{
+				chunk.VertexOffset = vertexCount;
+				chunk.IndexOffset = indexCount;
+				vertexCount += chunk.Vertices.size() - chunk.DroppedCount;
+				indexCount += chunk.Indices.size();
+			}
+
+			if (WeldVertices)
+				RemapChunkSeams(chunks);
+
+			if (sink != NULL)
+			{
+				if (!sink->Allocate || !sink->Allocate(*sink, vertexCount, indexCount / 3))
+					return false;
+
+				algorithm::parallelChunks(chunks.size(), [&](size_t c)
+				{
+					StitchChunk(chunks[c], c, sink);
+				});
+			}
+			else if (chunks.size() == 1)
+			{
+				LoadedVertices.swap(chunks[0].Vertices);
+				LoadedIndices.swap(chunks[0].Indices);
+			}
+			else
+			{
+				LoadedVertices.resize(vertexCount);
+				LoadedIndices.resize(indexCount);
+
+				algorithm::parallelChunks(chunks.size(), [&](size_t c)
+				{
+					StitchChunk(chunks[c], c, NULL);
+				});
+			}
+
+			// Replay the mesh boundaries in file order, the geometry
+			//	can only be copied into the meshes when it is kept
+			MeshState meshes;
+			meshes.copyGeometry = !SharedStorage && sink == NULL;
+			for (LoadChunk& chunk : chunks)
+			{
+				for (const LoadEvent& event : chunk.Events)
+				{
+					size_t eventVertex = chunk.VertexOffset + event.VertexCount - chunk.DroppedCount;
+					size_t eventIndex = chunk.IndexOffset + event.IndexCount;
+
+					switch (event.Type)
+					{
+					case LINE_OBJECT:
+						BeginObject(meshes, event.Line, eventVertex, eventIndex);
+						break;
+					case LINE_USEMTL:
+						BeginMaterial(meshes, event.Line, eventVertex, eventIndex);
+						break;
+					case LINE_MTLLIB:
+						LoadMaterialLibrary(Path, event.Line);
+						break;
+					default:
+						break;
+					}
+				}
+			}
+
+			file.Close();
+
+			// Deal with last mesh and set Materials for each Mesh
+			FinishMeshes(meshes, vertexCount, indexCount);
+
+			if (LoadedMeshes.empty() && vertexCount == 0 && indexCount == 0)
+				return false;
+
+			if (UseBinaryCache)
+				SaveCache(Path, sink, vertexCount, indexCount);
+
+			return true;
+		}
+
+		// Copy the kept vertices and the remapped indices of a
+		//	chunk to their global position in the loaded lists,
+		//	or in the arrays of a sink when one is given
+		void StitchChunk(LoadChunk& chunk, size_t c, BufferSink* sink)
+		{
+			size_t lead = chunk.LeadRemap.size();
+			size_t vertex = chunk.VertexOffset;
+			for (size_t i = 0; i < chunk.Vertices.size(); i++)
+			{
+				if (i < lead && chunk.LeadTargets[i].first != c)
+					continue;
+
+				if (sink != NULL)
+				{
+					const Vector3& position = chunk.Vertices[i].Position;
+					size_t at = vertex * sink->PositionStride;
+					sink->X[at] = position.X;
+					sink->Y[at] = position.Y;
+					sink->Z[at] = position.Z;
+				}
+				else
+				{
+					LoadedVertices[vertex] = chunk.Vertices[i];
+				}
+				vertex++;
+			}
+
+			unsigned int shift = (unsigned int)(chunk.VertexOffset - chunk.DroppedCount);
+			for (size_t i = 0; i < chunk.Indices.size(); i++)
+			{
+				unsigned int index = chunk.Indices[i];
+				index = index < lead ? chunk.LeadRemap[index] : index + shift;
+
+				if (sink != NULL)
+				{
+					size_t corner = chunk.IndexOffset + i;
+					unsigned int* triangle = sink->Triangles + corner / 3 * sink->TriangleStride;
+					triangle[corner % 3] = index;
+					if (corner % 3 == 2 && sink->TriangleStride > 3)
+						triangle[3] = 0;
+				}
+				else
+				{
+					LoadedIndices[chunk.IndexOffset + i] = index;
+				}
+			}
+
+			std::vector<Vertex>().swap(chunk.Vertices);
+			std::vector<unsigned int>().swap(chunk.Indices);
+		}
+
+		// Get the size and modification time of a file
+		static bool FileStamp(const std::string& Path, uint64_t& size, int64_t& time)
+		{
+			#ifdef _WIN32
+			struct __stat64 fileStat;
+			if (_stat64(Path.c_str(), &fileStat) != 0)
+				return false;
+			time = (int64_t)fileStat.st_mtime;
+			#else
+			struct stat fileStat;
+			if (stat(Path.c_str(), &fileStat) != 0)
+				return false;
+			#ifdef __APPLE__
+			time = (int64_t)fileStat.st_mtimespec.tv_sec * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+			#else
+			time = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+			#endif
+			#endif
+			size = (uint64_t)fileStat.st_size;
+			return true;
+		}
+
+		// Append a value to the table section of a binary cache
+		template <class T>
+		static void CachePut(std::string& table, T value)
+		{
+			table.append((const char*)&value, sizeof(T));
+		}
+		static void CachePutString(std::string& table, const std::string& value)
+		{
+			CachePut(table, (uint32_t)value.size());
+			table += value;
+		}
+		static void CachePutVector3(std::string& table, const Vector3& value)
+		{
+			CachePut(table, value.X);
+			CachePut(table, value.Y);
+			CachePut(table, value.Z);
+		}
+
+		// Load the meshes from the binary cache of an .obj
+		//	file, into the loaded lists or the arrays of a sink
+		//
+		// If the cache exists, matches the .obj file, its
+		// material libraries and the load options and is
+		// consistent return true
+		//
+		// Otherwise nothing is loaded and return false
+		bool LoadCache(const std::string& Path, BufferSink* sink)
+		{
+			uint64_t sourceSize;
+			int64_t sourceTime;
+			if (!FileStamp(Path, sourceSize, sourceTime))
+				return false;
+
+			MappedFile file;
+			if (!file.Open(Path + ".cache") || file.Size() < sizeof(CacheHeader))
+				return false;
+
+			CacheHeader header;
+			memcpy(&header, file.Data(), sizeof(CacheHeader));
+			if (memcmp(header.Magic, CacheMagic, sizeof(CacheMagic)) != 0
+				|| header.Version != CacheVersion
+				|| header.Welded != (WeldVertices ? 1u : 0u)
+				|| header.SourceSize != sourceSize || header.SourceTime != sourceTime)
+				return false;
+
+			// A cache of positions can only fill a sink
+			if (header.VertexBytes != sizeof(Vertex)
+				&& (sink == NULL || header.VertexBytes != sizeof(Vector3)))
+				return false;
+
+			// The sections must add up to the file size
+			size_t size = file.Size();
+			size_t tableEnd = sizeof(CacheHeader) + ((header.TableBytes + 7) & ~(uint64_t)7);
+			if (header.TableBytes > size || header.VertexCount > size / header.VertexBytes
+				|| header.IndexCount > size / sizeof(unsigned int) || header.IndexCount % 3 != 0
+				|| tableEnd + header.VertexCount * header.VertexBytes
+				+ header.IndexCount * sizeof(unsigned int) != size)
+				return false;
+
+			size_t vertexCount = (size_t)header.VertexCount;
+			size_t indexCount = (size_t)header.IndexCount;
+			const char* vertices = file.Data() + tableEnd;
+			const unsigned int* indices = (const unsigned int*)(vertices + vertexCount * header.VertexBytes);
+
+			CacheReader table(file.Data() + sizeof(CacheHeader),
+				file.Data() + sizeof(CacheHeader) + header.TableBytes);
+
+			if (table.ReadString() != Path)
+				return false;
+
+			std::vector<std::string> libraries(table.Read<uint32_t>());
+			for (size_t i = 0; i < libraries.size() && table.ok; i++)
+			{
+				libraries[i] = table.ReadString();
+				uint64_t cachedSize = table.Read<uint64_t>();
+				int64_t cachedTime = table.Read<int64_t>();
+
+				uint64_t librarySize = 0;
+				int64_t libraryTime = 0;
+				FileStamp(libraries[i], librarySize, libraryTime);
+				if (librarySize != cachedSize || libraryTime != cachedTime)
+					return false;
+			}
+
+			std::vector<Material> materials(table.ok ? table.Read<uint32_t>() : 0);
+			for (size_t i = 0; i < materials.size() && table.ok; i++)
+			{
+				Material& material = materials[i];
+				material.name = table.ReadString();
+				material.Ka = table.ReadVector3();
+				material.Kd = table.ReadVector3();
+				material.Ks = table.ReadVector3();
+				material.Ns = table.Read<float>();
+				material.Ni = table.Read<float>();
+				material.d = table.Read<float>();
+				material.illum = table.Read<int32_t>();
+				material.map_Ka = table.ReadString();
+				material.map_Kd = table.ReadString();
+				material.map_Ks = table.ReadString();
+				material.map_Ns = table.ReadString();
+				material.map_d = table.ReadString();
+				material.map_bump = table.ReadString();
+			}
+
+			std::vector<Mesh> meshes(table.ok ? table.Read<uint32_t>() : 0);
+			for (size_t i = 0; i < meshes.size() && table.ok; i++)
+			{
+				Mesh& mesh = meshes[i];
+				mesh.MeshName = table.ReadString();
+				mesh.VertexOffset = (size_t)table.Read<uint64_t>();
+				mesh.VertexCount = (size_t)table.Read<uint64_t>();
+				mesh.IndexOffset = (size_t)table.Read<uint64_t>();
+				mesh.IndexCount = (size_t)table.Read<uint64_t>();
+				int32_t material = table.Read<int32_t>();
+
+				if (mesh.VertexOffset > vertexCount || mesh.VertexCount > vertexCount - mesh.VertexOffset
+					|| mesh.IndexOffset > indexCount || mesh.IndexCount > indexCount - mesh.IndexOffset
+					|| material >= (int32_t)materials.size())
+					return false;
+				if (material >= 0)
+					mesh.MeshMaterial = materials[material];
+			}
+			if (!table.ok)
+				return false;
+
+			// Every index must name a cached vertex
+			for (size_t i = 0; i < indexCount; i++)
+			{
+				if (indices[i] >= vertexCount)
+					return false;
+			}
+
+			LoadedMeshes.clear();
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			LoadedMaterials.swap(materials);
+			MaterialLibraries.swap(libraries);
+
+			if (sink != NULL)
+			{
+				if (!sink->Allocate || !sink->Allocate(*sink, vertexCount, indexCount / 3))
+					return false;
+
+				for (size_t i = 0; i < vertexCount; i++)
+				{
+					// Position is the first member of a Vertex
+					float position[3];
+					memcpy(position, vertices + i * header.VertexBytes, sizeof(position));
+					size_t at = i * sink->PositionStride;
+					sink->X[at] = position[0];
+					sink->Y[at] = position[1];
+					sink->Z[at] = position[2];
+				}
+				for (size_t t = 0; t < indexCount / 3; t++)
+				{
+					unsigned int* triangle = sink->Triangles + t * sink->TriangleStride;
+					triangle[0] = indices[t * 3];
+					triangle[1] = indices[t * 3 + 1];
+					triangle[2] = indices[t * 3 + 2];
+					if (sink->TriangleStride > 3)
+						triangle[3] = 0;
+				}
+
+				LoadedMeshes.swap(meshes);
+				return true;
+			}
+
+			LoadedVertices.resize(vertexCount);
+			memcpy(LoadedVertices.data(), vertices, vertexCount * sizeof(Vertex));
+			LoadedIndices.assign(indices, indices + indexCount);
+
+			if (!SharedStorage)
+			{
+				for (Mesh& mesh : meshes)
+					CopyMeshGeometry(mesh);
+			}
+
+			LoadedMeshes.swap(meshes);
+			return true;
+		}
+
+		// Write the binary cache of an .obj file from the
+		//	loaded lists, or from the arrays of a sink (which
+		//	only hold positions) when one is given
+		//
+		// The cache is written next to the final name, under
+		// a name of its own for each process, and renamed
+		// over it, so a reader never sees it half written and
+		// concurrent writers do not truncate each other
+		//
+		// If the cache is written return true
+		bool SaveCache(const std::string& Path, const BufferSink* sink, size_t vertexCount, size_t indexCount)
+		{
+			CacheHeader header;
+			memset(&header, 0, sizeof(CacheHeader));
+			memcpy(header.Magic, CacheMagic, sizeof(CacheMagic));
+			header.Version = CacheVersion;
+			header.Welded = WeldVertices ? 1 : 0;
+			if (!FileStamp(Path, header.SourceSize, header.SourceTime))
+				return false;
+			header.VertexCount = vertexCount;
+			header.VertexBytes = sink != NULL ? sizeof(Vector3) : sizeof(Vertex);
+			header.IndexCount = indexCount;
+
+			std::string table;
+			CachePutString(table, Path);
+
+			CachePut(table, (uint32_t)MaterialLibraries.size());
+			for (const std::string& library : MaterialLibraries)
+			{
+				uint64_t librarySize = 0;
+				int64_t libraryTime = 0;
+				FileStamp(library, librarySize, libraryTime);
+				CachePutString(table, library);
+				CachePut(table, librarySize);
+				CachePut(table, libraryTime);
+			}
+
+			CachePut(table, (uint32_t)LoadedMaterials.size());
+			for (const Material& material : LoadedMaterials)
+			{
+				CachePutString(table, material.name);
+				CachePutVector3(table, material.Ka);
+				CachePutVector3(table, material.Kd);
+				CachePutVector3(table, material.Ks);
+				CachePut(table, material.Ns);
+				CachePut(table, material.Ni);
+				CachePut(table, material.d);
+				CachePut(table, (int32_t)material.illum);
+				CachePutString(table, material.map_Ka);
+				CachePutString(table, material.map_Kd);
+				CachePutString(table, material.map_Ks);
+				CachePutString(table, material.map_Ns);
+				CachePutString(table, material.map_d);
+				CachePutString(table, material.map_bump);
+			}
+
+			CachePut(table, (uint32_t)LoadedMeshes.size());
+			for (const Mesh& mesh : LoadedMeshes)
+			{
+				// Materials are assigned by name, so the first
+				//	material with the name is the mesh material
+				int32_t material = -1;
+				for (size_t j = 0; j < LoadedMaterials.size() && !mesh.MeshMaterial.name.empty(); j++)
+				{
+					if (LoadedMaterials[j].name == mesh.MeshMaterial.name)
+					{
+						material = (int32_t)j;
+						break;
+					}
+				}
+
+				CachePutString(table, mesh.MeshName);
+				CachePut(table, (uint64_t)mesh.VertexOffset);
+				CachePut(table, (uint64_t)mesh.VertexCount);
+				CachePut(table, (uint64_t)mesh.IndexOffset);
+				CachePut(table, (uint64_t)mesh.IndexCount);
+				CachePut(table, material);
+			}
+
+			header.TableBytes = table.size();
+			table.resize((table.size() + 7) & ~(size_t)7, 0);
+
+			std::string cachePath = Path + ".cache";
+			std::string writePath = cachePath + "." + std::to_string(ProcessId()) + ".tmp";
+			std::ofstream file(writePath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+				return false;
+
+			file.write((const char*)&header, sizeof(CacheHeader));
+			file.write(table.data(), table.size());
+
+			if (sink == NULL)
+			{
+				file.write((const char*)LoadedVertices.data(), vertexCount * sizeof(Vertex));
+				file.write((const char*)LoadedIndices.data(), indexCount * sizeof(unsigned int));
+			}
+			else
+			{
+				// Gather the strided sink arrays in blocks
+				const size_t block = 1 << 16;
+				std::vector<float> positions;
+				for (size_t first = 0; first < vertexCount; first += block)
+				{
+					size_t last = std::min(first + block, vertexCount);
+					positions.clear();
+					for (size_t i = first; i < last; i++)
+					{
+						size_t at = i * sink->PositionStride;
+						positions.push_back(sink->X[at]);
+						positions.push_back(sink->Y[at]);
+						positions.push_back(sink->Z[at]);
+					}
+					file.write((const char*)positions.data(), positions.size() * sizeof(float));
+				}
+
+				std::vector<unsigned int> triangles;
+				for (size_t first = 0; first < indexCount / 3; first += block)
+				{
+					size_t last = std::min(first + block, indexCount / 3);
+					triangles.clear();
+					for (size_t t = first; t < last; t++)
+					{
+						const unsigned int* triangle = sink->Triangles + t * sink->TriangleStride;
+						triangles.insert(triangles.end(), triangle, triangle + 3);
+					}
+					file.write((const char*)triangles.data(), triangles.size() * sizeof(unsigned int));
+				}
+			}
+
+			file.close();
+			if (!file)
+			{
+				std::remove(writePath.c_str());
+				return false;
+			}
+
+			#ifdef _WIN32
+			if (!MoveFileExA(writePath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+			#else
+			if (std::rename(writePath.c_str(), cachePath.c_str()) != 0)
+			#endif
+			{
+				std::remove(writePath.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		// Split a mapped file into newline aligned chunks,
+		//	one per thread
+		static void SplitChunks(std::vector<LoadChunk>& chunks,
+			const char* data, size_t size, unsigned int ThreadCount)
+		{
+			size_t count = ThreadCount != 0 ? ThreadCount : std::thread::hardware_concurrency();
+			if (count > size / MinChunkBytes)
+				count = size / MinChunkBytes;
+			if (count == 0)
+				count = 1;
+
+			chunks.resize(count);
+
+			const char* end = data + size;
+			const char* begin = data;
+			for (size_t c = 0; c < count; c++)
+			{
+				const char* split = end;
+				if (c + 1 < count)
+				{
+					split = data + size / count * (c + 1);
+					if (split < begin)
+						split = begin;
+					const char* eol = (const char*)memchr(split, '\n', end - split);
+					split = eol != NULL ? eol + 1 : end;
+				}
+
+				chunks[c].Begin = begin;
+				chunks[c].End = split;
+				begin = split;
+			}
+		}
+
+		// Parse the v, vt and vn records of a chunk
+		static void ParseChunkAttributes(LoadChunk& chunk)
+		{
+			const char* cursor = chunk.Begin;
+			while (cursor < chunk.End)
+			{
+				std::string_view curline = algorithm::nextLine(cursor, chunk.End);
+
+				switch (LineType(curline))
+				{
+				case LINE_POSITION:
+					chunk.Positions.push_back(ParseVector3(curline));
+					break;
+				case LINE_TCOORD:
+					chunk.TCoords.push_back(ParseVector2(curline));
+					break;
+				case LINE_NORMAL:
+					chunk.Normals.push_back(ParseVector3(curline));
+					break;
+				default:
+					break;
+				}
+			}
+		}
+
+		// Generate the vertices and indices of the faces of a
+		//	chunk and record its mesh and material lines
+		void ParseChunkFaces(LoadChunk& chunk,
+			const std::vector<Vector3>& Positions,
+			const std::vector<Vector2>& TCoords,
+			const std::vector<Vector3>& Normals)
+		{
+			size_t positionCount = chunk.PositionOffset;
+			size_t tcoordCount = chunk.TCoordOffset;
+			size_t normalCount = chunk.NormalOffset;
+
+			FaceScratch scratch;
+
+			const char* cursor = chunk.Begin;
+			while (cursor < chunk.End)
+			{
+				std::string_view curline = algorithm::nextLine(cursor, chunk.End);
+				int type = LineType(curline);
+
+				switch (type)
+				{
+				case LINE_POSITION:
+					positionCount++;
+					break;
+				case LINE_TCOORD:
+					tcoordCount++;
+					break;
+				case LINE_NORMAL:
+					normalCount++;
+					break;
+				case LINE_FACE:
+				{
+					AppendFace(scratch, chunk.Vertices, chunk.Indices, WeldVertices ? &chunk.WeldTail : NULL,
+						Positions, TCoords, Normals,
+						positionCount, tcoordCount, normalCount,
+						algorithm::tailView(curline));
+
+					// Remember the keys of the vertices before the first weld scope break
+					if (WeldVertices && !chunk.WeldBreak)
+					{
+						for (size_t i = 0; i < scratch.corners.size(); i++)
+						{
+							if (scratch.corners[i] == chunk.LeadKeys.size())
+								chunk.LeadKeys.push_back(scratch.vKeys[i]);
+						}
+					}
+					break;
+				}
+				case LINE_OBJECT:
+				case LINE_USEMTL:
+				case LINE_MTLLIB:
+				{
+					if (type != LINE_MTLLIB && !chunk.WeldBreak)
+					{
+						chunk.WeldBreak = true;
+						chunk.LeadCount = chunk.Vertices.size();
+					}
+					if (type != LINE_MTLLIB)
+						chunk.WeldTail.clear();
+
+					LoadEvent event;
+					event.Type = type;
+					event.Line = curline;
+					event.VertexCount = chunk.Vertices.size();
+					event.IndexCount = chunk.Indices.size();
+					chunk.Events.push_back(event);
+					break;
+				}
+				default:
+					break;
+				}
+			}
+
+			if (!chunk.WeldBreak)
+				chunk.LeadCount = chunk.Vertices.size();
+		}
+
+		// Find the leading vertices of every chunk that were
+		//	already welded by a previous chunk of the same weld
+		//	scope and count how many each chunk drops
+		//
+		// LeadRemap holds the rank of every kept leading vertex
+		// until the chunk offsets are known
+		static void WeldChunkSeams(std::vector<LoadChunk>& chunks)
+		{
+			algorithm::parallelChunks(chunks.size(), [&](size_t c)
+			{
+				LoadChunk& chunk = chunks[c];
+				chunk.LeadTargets.resize(chunk.LeadCount);
+				chunk.LeadRemap.resize(chunk.LeadCount);
+
+				// Previous chunks the leading scope continues, earliest first
+				size_t first = c;
+				while (first > 0)
+				{
+					first--;
+					if (chunks[first].WeldBreak)
+						break;
+				}
+
+				unsigned int rank = 0;
+				for (size_t i = 0; i < chunk.LeadCount; i++)
+				{
+					chunk.LeadTargets[i] = std::make_pair(c, (unsigned int)i);
+					chunk.LeadRemap[i] = 0;
+					for (size_t j = first; j < c; j++)
+					{
+						WeldMap::const_iterator found = chunks[j].WeldTail.find(chunk.LeadKeys[i]);
+						if (found != chunks[j].WeldTail.end())
+						{
+							chunk.LeadTargets[i] = std::make_pair(j, found->second);
+							chunk.DroppedCount++;
+							break;
+						}
+					}
+					if (chunk.LeadTargets[i].first == c)
+						chunk.LeadRemap[i] = rank++;
+				}
+			});
+		}
+
+		// Turn the leading vertex ranks and merge targets of every
+		//	chunk into global vertex indices
+		static void RemapChunkSeams(std::vector<LoadChunk>& chunks)
+		{
+			// Kept leading vertices first, so dropped ones can look them up
+			algorithm::parallelChunks(chunks.size(), [&](size_t c)
+			{
+				LoadChunk& chunk = chunks[c];
+				for (size_t i = 0; i < chunk.LeadCount; i++)
+				{
+					if (chunk.LeadTargets[i].first == c)
+						chunk.LeadRemap[i] += (unsigned int)chunk.VertexOffset;
+				}
+			});
+
+			// A merge target is never a dropped vertex itself
+			algorithm::parallelChunks(chunks.size(), [&](size_t c)
+			{
+				LoadChunk& chunk = chunks[c];
+				for (size_t i = 0; i < chunk.LeadCount; i++)
+				{
+					size_t j = chunk.LeadTargets[i].first;
+					unsigned int m = chunk.LeadTargets[i].second;
+					if (j == c)
+						continue;
+
+					const LoadChunk& target = chunks[j];
+					if (m < target.LeadCount)
+						chunk.LeadRemap[i] = target.LeadRemap[m];
+					else
+						chunk.LeadRemap[i] = (unsigned int)(target.VertexOffset + m - target.DroppedCount);
+				}
+			});
+		}
+
+		// Add the vertices and triangulated indices of a face
+		//
+		// With a weld map, corners that share their indices
+		// with an earlier corner of the weld scope reuse its
+		// vertex
+		void AppendFace(FaceScratch& scratch,
+			std::vector<Vertex>& oVertices, std::vector<unsigned int>& oIndices,
+			WeldMap* weld,
+			const std::vector<Vector3>& iPositions,
+			const std::vector<Vector2>& iTCoords,
+			const std::vector<Vector3>& iNormals,
+			size_t iPositionCount, size_t iTCoordCount, size_t iNormalCount,
+			std::string_view iface)
+		{
+			// Generate the vertices
+			scratch.vVerts.clear();
+			scratch.vKeys.clear();
+			GenVerticesFromView(scratch.vVerts, iPositions, iTCoords, iNormals,
+				iPositionCount, iTCoordCount, iNormalCount, iface,
+				weld != NULL ? &scratch.vKeys : NULL);
+
+			scratch.iIndices.clear();
+			TriangulateFace(scratch.iIndices, scratch.vVerts, scratch);
+
+			if (weld == NULL)
+			{
+				// Add Vertices
+				oVertices.insert(oVertices.end(), scratch.vVerts.begin(), scratch.vVerts.end());
+
+				// Add Indices
+				unsigned int faceStart = (unsigned int)(oVertices.size() - scratch.vVerts.size());
+				for (int i = 0; i < int(scratch.iIndices.size()); i++)
+				{
+					oIndices.push_back(faceStart + scratch.iIndices[i]);
+				}
+				return;
+			}
+
+			// Add the Vertices not welded yet
+			scratch.corners.clear();
+			for (size_t i = 0; i < scratch.vVerts.size(); i++)
+			{
+				std::pair<WeldMap::iterator, bool> found =
+					weld->emplace(scratch.vKeys[i], (unsigned int)oVertices.size());
+				if (found.second)
+					oVertices.push_back(scratch.vVerts[i]);
+				scratch.corners.push_back(found.first->second);
+			}
+
+			// Add Indices
+			for (int i = 0; i < int(scratch.iIndices.size()); i++)
+			{
+				oIndices.push_back(scratch.corners[scratch.iIndices[i]]);
+			}
+		}
+
+		// Generate vertices from a list of positions,
+		//	tcoords, normals and the tail of a face line
+		//
+		// The counts are the number of positions, tcoords
+		// and normals defined before the face, used to
+		// resolve relative (negative) indices
+		void GenVerticesFromView(std::vector<Vertex>& oVerts,
+			const std::vector<Vector3>& iPositions,
+			const std::vector<Vector2>& iTCoords,
+			const std::vector<Vector3>& iNormals,
+			size_t iPositionCount, size_t iTCoordCount, size_t iNormalCount,
+			std::string_view iface,
+			std::vector<VertexKey>* oKeys = NULL)
+		{
+			Vertex vVert;
+			VertexKey vKey;
+			bool noNormal = false;
+
+			// For every given vertex do this
+			for (std::string_view svert = algorithm::nextToken(iface); !svert.empty();
+				svert = algorithm::nextToken(iface))
+			{
+				// Split into position, texture and normal parts
+				std::string_view spos = svert, stex, snor;
+				size_t slash = svert.find('/');
+				if (slash != std::string_view::npos)
+				{
+					spos = svert.substr(0, slash);
+					stex = svert.substr(slash + 1);
+					slash = stex.find('/');
+					if (slash != std::string_view::npos)
+					{
+						snor = stex.substr(slash + 1);
+						stex = stex.substr(0, slash);
+					}
+				}
+
+				vKey.Position = algorithm::resolveIndexView(iPositionCount, spos);
+				vKey.TCoord = -1;
+				vKey.Normal = -1;
+
+				vVert.Position = iPositions[vKey.Position];
+
+				if (!stex.empty())
+				{
+					vKey.TCoord = algorithm::resolveIndexView(iTCoordCount, stex);
+					vVert.TextureCoordinate = iTCoords[vKey.TCoord];
+				}
+				else
+				{
+					vVert.TextureCoordinate = Vector2(0, 0);
+				}
+
+				if (!snor.empty())
+				{
+					vKey.Normal = algorithm::resolveIndexView(iNormalCount, snor);
+					vVert.Normal = iNormals[vKey.Normal];
+				}
+				else
+				{
+					noNormal = true;
+				}
+
+				oVerts.push_back(vVert);
+				if (oKeys != NULL)
+					oKeys->push_back(vKey);
+			}
+
+			// take care of missing normals
+			if (noNormal && oVerts.size() >= 3)
+			{
+				Vector3 A = oVerts[0].Position - oVerts[1].Position;
+				Vector3 B = oVerts[2].Position - oVerts[1].Position;
+
+				Vector3 normal = math::CrossV3(A, B);
+
+				for (int i = 0; i < int(oVerts.size()); i++)
+				{
+					oVerts[i].Normal = normal;
+				}
+			}
+		}
+
+		// Generate vertices from a list of positions, 
+		//	tcoords, normals and a face line
+		void GenVerticesFromRawOBJ(std::vector<Vertex>& oVerts,
+			const std::vector<Vector3>& iPositions,
+			const std::vector<Vector2>& iTCoords,
+			const std::vector<Vector3>& iNormals,
+			std::string icurline)
+		{
+			std::vector<std::string> sface, svert;
+			Vertex vVert;
+			algorithm::split(algorithm::tail(icurline), sface, " ");
+
+			bool noNormal = false;
+
+			// For every given vertex do this
+			for (int i = 0; i < int(sface.size()); i++)
+			{
+				// See What type the vertex is.
+				int vtype;
+
+				algorithm::split(sface[i], svert, "/");
+
+				// Check for just position - v1
+				if (svert.size() == 1)
+				{
+					// Only position
+					vtype = 1;
+				}
+
+				// Check for position & texture - v1/vt1
+				if (svert.size() == 2)
+				{
+					// Position & Texture
+					vtype = 2;
+				}
+
+				// Check for Position, Texture and Normal - v1/vt1/vn1
+				// or if Position and Normal - v1//vn1
+				if (svert.size() == 3)
+				{
+					if (svert[1] != "")
+					{
+						// Position, Texture, and Normal
+						vtype = 4;
+					}
+					else
+					{
+						// Position & Normal
+						vtype = 3;
+					}
+				}
+
+				// Calculate and store the vertex
+				switch (vtype)
+				{
+				case 1: // P
+				{
+					vVert.Position = algorithm::getElement(iPositions, svert[0]);
+					vVert.TextureCoordinate = Vector2(0, 0);
+					noNormal = true;
+					oVerts.push_back(vVert);
+					break;
+				}
+				case 2: // P/T
+				{
+					vVert.Position = algorithm::getElement(iPositions, svert[0]);
+					vVert.TextureCoordinate = algorithm::getElement(iTCoords, svert[1]);
+					noNormal = true;
+					oVerts.push_back(vVert);
+					break;
+				}
+				case 3: // P//N
+				{
+					vVert.Position = algorithm::getElement(iPositions, svert[0]);
+					vVert.TextureCoordinate = Vector2(0, 0);
+					vVert.Normal = algorithm::getElement(iNormals, svert[2]);
+					oVerts.push_back(vVert);
+					break;
+				}
+				case 4: // P/T/N
+				{
+					vVert.Position = algorithm::getElement(iPositions, svert[0]);
+					vVert.TextureCoordinate = algorithm::getElement(iTCoords, svert[1]);
+					vVert.Normal = algorithm::getElement(iNormals, svert[2]);
+					oVerts.push_back(vVert);
+					break;
+				}
+				default:
 				{
 					break;
 				}
@@ -833,6 +2965,280 @@ namespace objl
 			}
 		}
 
+		// Triangulate a list of vertices into a face by printing
+		//	indices corresponding with triangles within it
+		//
+		// Triangles, quads and convex polygons are split
+		// directly, matching VertexTriangluation: a quad
+		// becomes 0 1 3 and 1 2 3 (0 1 2 and 0 2 3 if
+		// corner 0 or 2 is reflex) and a convex polygon
+		// a fan around its last corner. Concave polygons
+		// are ear clipped by corner index, so repeated
+		// positions are never confused
+		static void TriangulateFace(std::vector<unsigned int>& oIndices,
+			const std::vector<Vertex>& iVerts, FaceScratch& scratch)
+		{
+			size_t n = iVerts.size();
+
+			// If there are 2 or less verts,
+			// no triangle can be created
+			if (n < 3)
+				return;
+
+			// If it is a triangle no need to calculate it
+			if (n == 3)
+			{
+				oIndices.push_back(0);
+				oIndices.push_back(1);
+				oIndices.push_back(2);
+				return;
+			}
+
+			// Newell normal, robust for non planar polygons
+			Vector3 normal;
+			for (size_t i = 0; i < n; i++)
+			{
+				const Vector3& a = iVerts[i].Position;
+				const Vector3& b = iVerts[i + 1 < n ? i + 1 : 0].Position;
+				normal.X += (a.Y - b.Y) * (a.Z + b.Z);
+				normal.Y += (a.Z - b.Z) * (a.X + b.X);
+				normal.Z += (a.X - b.X) * (a.Y + b.Y);
+			}
+
+			// A corner is convex when it turns the same way as the normal,
+			//	nearly straight corners rounded the wrong way by the
+			//	printed precision of the file still count as convex
+			float normalLength = math::MagnitudeV3(normal);
+			auto convexAt = [&](size_t i)
+			{
+				const Vector3& a = iVerts[i == 0 ? n - 1 : i - 1].Position;
+				const Vector3& b = iVerts[i].Position;
+				const Vector3& c = iVerts[i + 1 < n ? i + 1 : 0].Position;
+				Vector3 turn = math::CrossV3(b - a, c - b);
+				return math::DotV3(turn, normal) >= -1e-4f * math::MagnitudeV3(b - a) * math::MagnitudeV3(c - b) * normalLength;
+			};
+
+			if (n == 4)
+			{
+				static const unsigned int split13[6] = { 0, 1, 3, 1, 2, 3 };
+				static const unsigned int split02[6] = { 0, 1, 2, 0, 2, 3 };
+				const unsigned int* split = convexAt(0) && convexAt(2) ? split13 : split02;
+				oIndices.insert(oIndices.end(), split, split + 6);
+				return;
+			}
+
+			bool convex = true;
+			for (size_t i = 0; i < n && convex; i++)
+				convex = convexAt(i);
+
+			if (convex)
+			{
+				for (size_t i = 0; i + 2 < n; i++)
+				{
+					oIndices.push_back((unsigned int)i);
+					oIndices.push_back((unsigned int)i + 1);
+					oIndices.push_back((unsigned int)n - 1);
+				}
+				return;
+			}
+
+			EarClipFace(oIndices, iVerts, normal, scratch);
+		}
+
+		// Ear clip a concave polygon projected onto the plane
+		//	of its normal
+		//
+		// Only reflex corners can lie inside an ear, so they
+		// are bucketed in a uniform grid and every ear test
+		// only visits the cells under the ear, which keeps
+		// the clipping close to linear for large facades
+		static void EarClipFace(std::vector<unsigned int>& oIndices,
+			const std::vector<Vertex>& iVerts, const Vector3& normal, FaceScratch& scratch)
+		{
+			size_t n = iVerts.size();
+
+			// Drop the dominant normal axis, keeping the
+			//	polygon counter clockwise in 2D
+			float ax = fabsf(normal.X), ay = fabsf(normal.Y), az = fabsf(normal.Z);
+			int axis = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+			float sign = (axis == 0 ? normal.X : axis == 1 ? normal.Y : normal.Z) < 0 ? -1.0f : 1.0f;
+
+			std::vector<float>& u = scratch.u;
+			std::vector<float>& v = scratch.v;
+			std::vector<unsigned int>& prev = scratch.prev;
+			std::vector<unsigned int>& next = scratch.next;
+			std::vector<char>& reflex = scratch.reflex;
+			u.resize(n);
+			v.resize(n);
+			prev.resize(n);
+			next.resize(n);
+			reflex.resize(n);
+
+			for (size_t i = 0; i < n; i++)
+			{
+				const Vector3& p = iVerts[i].Position;
+				if (axis == 0)
+				{
+					u[i] = p.Y;
+					v[i] = p.Z * sign;
+				}
+				else if (axis == 1)
+				{
+					u[i] = p.Z;
+					v[i] = p.X * sign;
+				}
+				else
+				{
+					u[i] = p.X;
+					v[i] = p.Y * sign;
+				}
+				prev[i] = (unsigned int)(i == 0 ? n - 1 : i - 1);
+				next[i] = (unsigned int)(i + 1 < n ? i + 1 : 0);
+			}
+
+			auto turn = [&](unsigned int a, unsigned int b, unsigned int c)
+			{
+				return (u[b] - u[a]) * (v[c] - v[b]) - (v[b] - v[a]) * (u[c] - u[b]);
+			};
+
+			// Bucket the reflex corners
+			float minU = 0, minV = 0, maxU = 0, maxV = 0;
+			size_t reflexCount = 0;
+			for (unsigned int i = 0; i < n; i++)
+			{
+				reflex[i] = turn(prev[i], i, next[i]) <= 0;
+				if (!reflex[i])
+					continue;
+				if (reflexCount == 0 || u[i] < minU) minU = u[i];
+				if (reflexCount == 0 || u[i] > maxU) maxU = u[i];
+				if (reflexCount == 0 || v[i] < minV) minV = v[i];
+				if (reflexCount == 0 || v[i] > maxV) maxV = v[i];
+				reflexCount++;
+			}
+
+			// Square cells holding about one reflex corner each,
+			//	so long thin facades are not cut into slivers
+			float width = maxU - minU, height = maxV - minV;
+			float cell = sqrtf(width * height / (reflexCount > 0 ? reflexCount : 1));
+			if (cell <= 0)
+				cell = std::max(width, height) / (reflexCount > 0 ? reflexCount : 1);
+			if (cell <= 0)
+				cell = 1;
+			size_t columns = std::min((size_t)(width / cell) + 1, reflexCount > 0 ? reflexCount : 1);
+			size_t rows = std::min((size_t)(height / cell) + 1, reflexCount > 0 ? reflexCount : 1);
+			float cellU = width > 0 ? width / columns : 1, cellV = height > 0 ? height / rows : 1;
+
+			auto cellOf = [&](float value, float low, float size, size_t count)
+			{
+				float at = (value - low) / size;
+				if (at <= 0)
+					return (size_t)0;
+				return at >= count - 1 ? count - 1 : (size_t)at;
+			};
+
+			std::vector<unsigned int>& cellStart = scratch.cellStart;
+			std::vector<unsigned int>& cellItems = scratch.cellItems;
+			cellStart.assign(rows * columns + 1, 0);
+			cellItems.resize(reflexCount);
+			for (unsigned int i = 0; i < n; i++)
+			{
+				if (reflex[i])
+					cellStart[cellOf(v[i], minV, cellV, rows) * columns + cellOf(u[i], minU, cellU, columns) + 1]++;
+			}
+			for (size_t c = 0; c < rows * columns; c++)
+				cellStart[c + 1] += cellStart[c];
+			for (unsigned int i = 0; i < n; i++)
+			{
+				if (reflex[i])
+					cellItems[cellStart[cellOf(v[i], minV, cellV, rows) * columns + cellOf(u[i], minU, cellU, columns)]++] = i;
+			}
+			for (size_t c = rows * columns; c > 0; c--)
+				cellStart[c] = cellStart[c - 1];
+			cellStart[0] = 0;
+
+			// A convex corner is an ear when no reflex corner
+			//	lies inside or on its triangle, a straight corner
+			//	or a repeated position is clipped as a degenerate
+			//	triangle since removing it leaves the outline as is
+			auto isEar = [&](unsigned int b)
+			{
+				unsigned int a = prev[b], c = next[b];
+				float corner = turn(a, b, c);
+				if (corner == 0)
+					return true;
+				if (corner < 0)
+					return false;
+
+				float lowU = std::min(u[a], std::min(u[b], u[c]));
+				float highU = std::max(u[a], std::max(u[b], u[c]));
+				float lowV = std::min(v[a], std::min(v[b], v[c]));
+				float highV = std::max(v[a], std::max(v[b], v[c]));
+
+				size_t lastV = cellOf(highV, minV, cellV, rows), lastU = cellOf(highU, minU, cellU, columns);
+				for (size_t cv = cellOf(lowV, minV, cellV, rows); cv <= lastV; cv++)
+				{
+					for (size_t cu = cellOf(lowU, minU, cellU, columns); cu <= lastU; cu++)
+					{
+						size_t at = cv * columns + cu;
+						for (unsigned int k = cellStart[at]; k < cellStart[at + 1]; k++)
+						{
+							unsigned int p = cellItems[k];
+							if (!reflex[p] || p == a || p == b || p == c)
+								continue;
+							if ((u[p] == u[a] && v[p] == v[a]) || (u[p] == u[b] && v[p] == v[b])
+								|| (u[p] == u[c] && v[p] == v[c]))
+								continue;
+							if (turn(a, b, p) >= 0 && turn(b, c, p) >= 0 && turn(c, a, p) >= 0)
+								return false;
+						}
+					}
+				}
+				return true;
+			};
+
+			size_t remaining = n;
+			unsigned int current = 0;
+			size_t misses = 0;
+			while (remaining > 3)
+			{
+				// Clip anyway when a full lap finds no ear,
+				//	which only happens for degenerate polygons
+				if (isEar(current) || misses > remaining)
+				{
+					unsigned int a = prev[current], c = next[current];
+					oIndices.push_back(a);
+					oIndices.push_back(current);
+					oIndices.push_back(c);
+
+					// Unlink the ear tip, it can no longer block an ear
+					next[a] = c;
+					prev[c] = a;
+					reflex[current] = 0;
+					remaining--;
+					misses = 0;
+
+					// Neighbours of the ear may have become convex
+					if (reflex[a])
+						reflex[a] = turn(prev[a], a, c) <= 0;
+					if (reflex[c])
+						reflex[c] = turn(a, c, next[c]) <= 0;
+
+					// Keep sweeping forward, clipping small local ears
+					//	first instead of fanning around one corner
+					current = next[c];
+				}
+				else
+				{
+					current = next[current];
+					misses++;
+				}
+			}
+
+			oIndices.push_back(prev[current]);
+			oIndices.push_back(current);
+			oIndices.push_back(next[current]);
+		}
+
 		// Triangulate a list of vertices into a face by printing
 		//	inducies corresponding with triangles within it
 		void VertexTriangluation(std::vector<unsigned int>& oIndices,
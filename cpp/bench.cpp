@@ -0,0 +1,633 @@
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// The LoadFile profile reads the time spent triangulating
+#ifndef OBJL_PROFILE
+#define OBJL_PROFILE
+#endif
+#include "OBJ_Loader.h"
+
+///
+//  Build about the given number of bytes of v lines
+//  from a fixed seed
+//
+std::string make_vertex_lines(size_t bytes, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+
+    std::string buffer;
+    buffer.reserve(bytes + 64);
+    char line[96];
+    while (buffer.size() < bytes)
+    {
+        int length = snprintf(line, sizeof(line), "v %f %f %f\n",
+            coordinate(random), coordinate(random), coordinate(random));
+        buffer.append(line, length);
+    }
+    return buffer;
+}
+
+///
+//  Build about the given number of bytes of v/vt/vn
+//  triangle f lines from a fixed seed
+//
+std::string make_face_lines(size_t bytes, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<unsigned int> index(1, 1000000);
+
+    std::string buffer;
+    buffer.reserve(bytes + 128);
+    char line[128];
+    while (buffer.size() < bytes)
+    {
+        unsigned int a = index(random), b = index(random), c = index(random);
+        int length = snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\n",
+            a, a, a, b, b, b, c, c, c);
+        buffer.append(line, length);
+    }
+    return buffer;
+}
+
+///
+//  Run a parse function over every line of a buffer and
+//  return the throughput in MB/s
+//
+template <class F>
+double throughput(const std::string& buffer, F parse)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    const char* cursor = buffer.data();
+    const char* end = cursor + buffer.size();
+    while (cursor < end)
+    {
+        parse(objl::algorithm::nextLine(cursor, end));
+    }
+
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return buffer.size() / (1024.0 * 1024.0) / seconds.count();
+}
+
+///
+//  Compare number parsing as LoadFile does it (split into
+//  strings, std::stof/std::stoi) with the from_chars engine
+//  used by the mapped loaders
+//
+void bench_numbers(size_t megabytes)
+{
+    std::string vertices = make_vertex_lines(megabytes << 20, 1);
+    std::string faces = make_face_lines(megabytes << 20, 2);
+
+    // Checksums keep the results alive
+    double sum = 0.0;
+    long long indexSum = 0;
+
+    std::string curline;
+    std::vector<std::string> tokens, parts;
+
+    double legacyVertex = throughput(vertices, [&](std::string_view line)
+    {
+        curline.assign(line);
+        objl::algorithm::split(objl::algorithm::tail(curline), tokens, " ");
+        sum += std::stof(tokens[0]) + std::stof(tokens[1]) + std::stof(tokens[2]);
+    });
+    double engineVertex = throughput(vertices, [&](std::string_view line)
+    {
+        float values[3] = { 0.0f, 0.0f, 0.0f };
+        objl::algorithm::nextToken(line);
+        objl::algorithm::parseFloats(line, values, 3);
+        sum += values[0] + values[1] + values[2];
+    });
+
+    double legacyFace = throughput(faces, [&](std::string_view line)
+    {
+        curline.assign(line);
+        objl::algorithm::split(objl::algorithm::tail(curline), tokens, " ");
+        for (const std::string& corner : tokens)
+        {
+            objl::algorithm::split(corner, parts, "/");
+            for (const std::string& part : parts)
+                indexSum += std::stoi(part);
+        }
+    });
+    double engineFace = throughput(faces, [&](std::string_view line)
+    {
+        objl::algorithm::nextToken(line);
+        for (std::string_view corner = objl::algorithm::nextToken(line); !corner.empty();
+            corner = objl::algorithm::nextToken(line))
+        {
+            size_t slash;
+            while ((slash = corner.find('/')) != std::string_view::npos)
+            {
+                indexSum += objl::algorithm::parseIntView(corner.substr(0, slash));
+                corner.remove_prefix(slash + 1);
+            }
+            indexSum += objl::algorithm::parseIntView(corner);
+        }
+    });
+
+    std::cout << "Number parsing over " << megabytes << " MB of each record type" << std::endl;
+    std::cout << "  v lines: split + stof " << legacyVertex << " MB/s, from_chars "
+        << engineVertex << " MB/s (" << engineVertex / legacyVertex << "x)" << std::endl;
+    std::cout << "  f lines: split + stoi " << legacyFace << " MB/s, from_chars "
+        << engineFace << " MB/s (" << engineFace / legacyFace << "x)" << std::endl;
+    std::cout << "  checksum " << sum << " " << indexSum << std::endl;
+}
+
+///
+//  Write polygons as an .obj file, each with its own
+//  vertices, placed on random planes away from the origin
+//
+bool write_polygons(const std::string& path,
+    const std::vector<std::vector<std::pair<float, float>>>& polygons, unsigned int seed)
+{
+    std::ofstream file(path);
+    if (!file.is_open())
+        return false;
+    file.precision(9);
+
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    file << "o polygons\n";
+    size_t vertex = 1;
+    std::string face;
+    for (const std::vector<std::pair<float, float>>& polygon : polygons)
+    {
+        // Plane origin and orthonormal axes
+        objl::Vector3 origin(unit(random) * 100, unit(random) * 100, unit(random) * 100);
+        objl::Vector3 e1(unit(random), unit(random), unit(random) + 2.0f);
+        e1 = e1 / objl::math::MagnitudeV3(e1);
+        objl::Vector3 e2 = objl::math::CrossV3(e1, objl::Vector3(unit(random), 1.0f, unit(random)));
+        e2 = e2 / objl::math::MagnitudeV3(e2);
+
+        face = "f";
+        for (const std::pair<float, float>& point : polygon)
+        {
+            objl::Vector3 p = origin + e1 * point.first + e2 * point.second;
+            file << "v " << p.X << " " << p.Y << " " << p.Z << "\n";
+            face += " " + std::to_string(vertex++);
+        }
+        file << face << "\n";
+    }
+    return true;
+}
+
+///
+//  Compare the triangulation of the mapped loader with
+//  LoadFile: triangles, quads and convex polygons must
+//  give the same topology, concave polygons (which
+//  LoadFile does not handle) must cover their area
+//  exactly with n - 2 triangles of the polygon winding
+//
+int verify_triangulation()
+{
+    const double pi = 3.14159265358979;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Triangles, quads and convex polygons up to 64 corners
+    std::vector<std::vector<std::pair<float, float>>> convex;
+    for (int i = 0; i < 3000; i++)
+    {
+        int corners = i % 3 == 0 ? 3 : i % 3 == 1 ? 4 : 5 + (int)(unit(random) * 60);
+        std::vector<std::pair<float, float>> polygon;
+        for (int c = 0; c < corners; c++)
+        {
+            double angle = (c + unit(random) * 0.8) * 2 * pi / corners;
+            polygon.push_back(std::make_pair((float)cos(angle) * 10, (float)sin(angle) * 10));
+        }
+        convex.push_back(polygon);
+    }
+
+    // Stars and facade-like combs up to 2000 corners
+    std::vector<std::vector<std::pair<float, float>>> concave;
+    for (int i = 0; i < 200; i++)
+    {
+        std::vector<std::pair<float, float>> polygon;
+        if (i % 2 == 0)
+        {
+            int corners = 2 * (3 + (int)(unit(random) * 500));
+            for (int c = 0; c < corners; c++)
+            {
+                double angle = 2 * pi * c / corners;
+                float radius = c % 2 == 0 ? 10.0f : 2.0f + unit(random) * 6;
+                polygon.push_back(std::make_pair((float)cos(angle) * radius, (float)sin(angle) * radius));
+            }
+        }
+        else
+        {
+            int teeth = 2 + (int)(unit(random) * 500);
+            for (int t = 0; t < teeth; t++)
+            {
+                float depth = 1.0f + unit(random) * 5;
+                polygon.push_back(std::make_pair(t * 2.0f, 0.0f));
+                polygon.push_back(std::make_pair(t * 2.0f + 1, 0.0f));
+                polygon.push_back(std::make_pair(t * 2.0f + 1, depth));
+                polygon.push_back(std::make_pair(t * 2.0f + 2, depth));
+            }
+            polygon.push_back(std::make_pair(teeth * 2.0f, 0.0f));
+            polygon.push_back(std::make_pair(teeth * 2.0f, -3.0f));
+            polygon.push_back(std::make_pair(0.0f, -3.0f));
+        }
+        concave.push_back(polygon);
+    }
+
+    // The test files are removed on the way out
+    const char* convexPath = "triangulation_convex.obj";
+    const char* concavePath = "triangulation_concave.obj";
+    auto removeFiles = [&]()
+    {
+        std::remove(convexPath);
+        std::remove(concavePath);
+    };
+    if (!write_polygons(convexPath, convex, 11) || !write_polygons(concavePath, concave, 13))
+    {
+        std::cerr << "Failed to write triangulation test files" << std::endl;
+        removeFiles();
+        return 1;
+    }
+
+    int failures = 0;
+
+    // Same topology as LoadFile
+    objl::Loader legacy, mapped;
+    auto start = std::chrono::steady_clock::now();
+    legacy.LoadFile(convexPath);
+    std::chrono::duration<double> legacySeconds = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    mapped.LoadFileMapped(convexPath);
+    std::chrono::duration<double> mappedSeconds = std::chrono::steady_clock::now() - start;
+
+    if (legacy.LoadedIndices != mapped.LoadedIndices)
+    {
+        std::cerr << "Convex topology differs from LoadFile" << std::endl;
+        failures++;
+    }
+    std::cout << "Convex: " << convex.size() << " polygons, " << mapped.LoadedIndices.size() / 3
+        << " triangles, LoadFile " << legacySeconds.count() << " s, LoadFileMapped "
+        << mappedSeconds.count() << " s" << std::endl;
+
+    // Exact cover with the polygon winding
+    start = std::chrono::steady_clock::now();
+    legacy.LoadFile(concavePath);
+    legacySeconds = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    mapped.LoadFileMapped(concavePath);
+    mappedSeconds = std::chrono::steady_clock::now() - start;
+
+    size_t vertex = 0, index = 0;
+    for (const std::vector<std::pair<float, float>>& polygon : concave)
+    {
+        size_t corners = polygon.size();
+
+        double area = 0.0;
+        for (size_t c = 0; c < corners; c++)
+        {
+            const std::pair<float, float>& a = polygon[c];
+            const std::pair<float, float>& b = polygon[(c + 1) % corners];
+            area += ((double)a.first * b.second - (double)b.first * a.second) / 2;
+        }
+
+        double covered = 0.0;
+        bool wound = true;
+        for (size_t t = 0; t + 2 < corners; t++, index += 3)
+        {
+            const std::pair<float, float>& a = polygon[mapped.LoadedIndices[index] - vertex];
+            const std::pair<float, float>& b = polygon[mapped.LoadedIndices[index + 1] - vertex];
+            const std::pair<float, float>& c = polygon[mapped.LoadedIndices[index + 2] - vertex];
+            double twice = ((double)b.first - a.first) * ((double)c.second - a.second)
+                - ((double)b.second - a.second) * ((double)c.first - a.first);
+            wound = wound && twice * area >= -1e-6;
+            covered += twice / 2;
+        }
+        vertex += corners;
+
+        if (!wound || fabs(covered - area) > 1e-3 * fabs(area))
+        {
+            std::cerr << "Concave polygon with " << corners << " corners covers " << covered
+                << " of " << area << (wound ? "" : ", some triangles flipped") << std::endl;
+            failures++;
+        }
+    }
+    if (index != mapped.LoadedIndices.size())
+    {
+        std::cerr << "Concave triangle count differs from n - 2 per polygon" << std::endl;
+        failures++;
+    }
+    std::cout << "Concave: " << concave.size() << " polygons, " << mapped.LoadedIndices.size() / 3
+        << " triangles, LoadFile " << legacySeconds.count() << " s, LoadFileMapped "
+        << mappedSeconds.count() << " s" << std::endl;
+
+    removeFiles();
+    std::cout << (failures == 0 ? "Triangulation matches" : "Triangulation FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+///
+//  Parse a size such as 4096, 512K, 64M or 2G
+//
+size_t parse_size(const std::string& text)
+{
+    size_t end = 0;
+    double value = std::stod(text, &end);
+    char unit = end < text.size() ? (char)toupper(text[end]) : 0;
+    if (unit == 'K')
+        value *= 1024.0;
+    else if (unit == 'M')
+        value *= 1024.0 * 1024.0;
+    else if (unit == 'G')
+        value *= 1024.0 * 1024.0 * 1024.0;
+    return (size_t)value;
+}
+
+///
+//  Write a deterministic .obj file of about the given number
+//  of bytes. Faces are tri, quad, ngon (5 to 12 corners) or
+//  a mix of them, every face is a convex polygon with its own
+//  vertices, with vt and vn lines when attributes is set, and
+//  every 100000 faces start a new object
+//
+bool generate_obj(const std::string& path, size_t bytes, const std::string& faces,
+    bool attributes, unsigned int seed)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    const double pi = 3.14159265358979;
+    const size_t facesPerObject = 100000;
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::string buffer;
+    char line[128];
+    size_t written = 0, vertex = 1;
+    for (size_t face = 0; written + buffer.size() < bytes; face++)
+    {
+        if (face % facesPerObject == 0)
+            buffer += "o part_" + std::to_string(face / facesPerObject) + "\n";
+
+        int corners = 3;
+        float pick = unit(random);
+        if (faces == "quad" || (faces == "mix" && pick >= 0.5f && pick < 0.85f))
+            corners = 4;
+        else if (faces == "ngon" || (faces == "mix" && pick >= 0.85f))
+            corners = 5 + (int)(unit(random) * 8);
+
+        // A polygon inside one cell of a 1000 wide grid
+        float x = (float)(face % 1000) * 2, y = (float)(face / 1000 % 1000) * 2, z = unit(random);
+        float phase = unit(random) * (float)(2 * pi);
+        for (int c = 0; c < corners; c++)
+        {
+            float angle = phase + (float)(2 * pi) * c / corners;
+            int length = snprintf(line, sizeof(line), "v %f %f %f\n",
+                x + cosf(angle) * 0.9f, y + sinf(angle) * 0.9f, z);
+            buffer.append(line, length);
+            if (attributes)
+            {
+                length = snprintf(line, sizeof(line), "vt %f %f\nvn 0.000000 0.000000 1.000000\n",
+                    cosf(angle) * 0.5f + 0.5f, sinf(angle) * 0.5f + 0.5f);
+                buffer.append(line, length);
+            }
+        }
+
+        buffer += "f";
+        for (int c = 0; c < corners; c++, vertex++)
+        {
+            int length = attributes
+                ? snprintf(line, sizeof(line), " %zu/%zu/%zu", vertex, vertex, vertex)
+                : snprintf(line, sizeof(line), " %zu", vertex);
+            buffer.append(line, length);
+        }
+        buffer += "\n";
+
+        if (buffer.size() >= (1 << 20))
+        {
+            file.write(buffer.data(), buffer.size());
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    file.write(buffer.data(), buffer.size());
+    return (bool)file;
+}
+
+// Steps of the line handling of LoadFile
+enum
+{
+    PHASE_IO,
+    PHASE_TOKENIZE,
+    PHASE_NUMBERS
+};
+
+///
+//  Read a file line by line the way LoadFile does, up to
+//  and including the given phase, and return the seconds
+//  taken
+//
+double replay_lines(const std::string& path, int phase, double& checksum)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::ifstream file(path);
+    std::string curline, face;
+    std::vector<std::string> tokens, corners, parts;
+    while (std::getline(file, curline))
+    {
+        checksum += curline.size();
+        if (phase < PHASE_TOKENIZE)
+            continue;
+
+        // The token tests LoadFile makes on every line
+        bool object = objl::algorithm::firstToken(curline) == "o"
+            || objl::algorithm::firstToken(curline) == "g" || curline[0] == 'g';
+        bool attribute = objl::algorithm::firstToken(curline) == "v"
+            || objl::algorithm::firstToken(curline) == "vt"
+            || objl::algorithm::firstToken(curline) == "vn";
+        bool isFace = objl::algorithm::firstToken(curline) == "f";
+        bool material = objl::algorithm::firstToken(curline) == "usemtl"
+            || objl::algorithm::firstToken(curline) == "mtllib";
+        checksum += object + material;
+
+        if (attribute)
+        {
+            objl::algorithm::split(objl::algorithm::tail(curline), tokens, " ");
+            if (phase >= PHASE_NUMBERS)
+            {
+                for (const std::string& token : tokens)
+                    checksum += std::stof(token);
+            }
+        }
+        else if (isFace)
+        {
+            // GenVerticesFromRawOBJ takes the line by value
+            face = curline;
+            objl::algorithm::split(objl::algorithm::tail(face), corners, " ");
+            for (const std::string& corner : corners)
+            {
+                objl::algorithm::split(corner, parts, "/");
+                if (phase < PHASE_NUMBERS)
+                    continue;
+                for (const std::string& part : parts)
+                {
+                    if (!part.empty())
+                        checksum += std::stoi(part);
+                }
+            }
+        }
+    }
+
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return seconds.count();
+}
+
+///
+//  Print the time and throughput of one phase
+//
+void print_phase(const char* name, double seconds, double megabytes)
+{
+    if (seconds < 0.0)
+        seconds = 0.0;
+    std::cout << "  " << name << std::string(18 - strlen(name), ' ') << seconds << " s";
+    if (seconds > 0.0)
+        std::cout << ", " << megabytes / seconds << " MB/s";
+    std::cout << std::endl;
+}
+
+///
+//  Time LoadFile on a file phase by phase
+//
+//  LoadFile reads, tokenizes and converts every line before
+//  it triangulates the faces and assembles the meshes, so
+//  the first three phases are timed by replaying its line
+//  handling one step further each time, triangulation is
+//  timed inside LoadFile (OBJL_PROFILE) and mesh assembly
+//  is the rest of its time. The mapped and parallel
+//  loaders are timed as a whole for comparison
+//
+void profile_load_file(const std::string& path)
+{
+    std::ifstream size(path, std::ios::binary | std::ios::ate);
+    double megabytes = size.tellg() / (1024.0 * 1024.0);
+    size.close();
+
+    // Warm the page cache so I/O is not a cold read
+    double checksum = 0.0;
+    replay_lines(path, PHASE_IO, checksum);
+
+    double io = replay_lines(path, PHASE_IO, checksum);
+    double tokenize = replay_lines(path, PHASE_TOKENIZE, checksum);
+    double numbers = replay_lines(path, PHASE_NUMBERS, checksum);
+
+    objl::Loader loader;
+    auto start = std::chrono::steady_clock::now();
+    loader.LoadFile(path);
+    std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+    double triangulation = loader.ProfileTriangulation;
+    size_t triangles = loader.LoadedIndices.size() / 3;
+
+    objl::Loader mapped;
+    start = std::chrono::steady_clock::now();
+    mapped.LoadFileMapped(path);
+    std::chrono::duration<double> mappedTotal = std::chrono::steady_clock::now() - start;
+
+    objl::Loader parallel;
+    start = std::chrono::steady_clock::now();
+    parallel.LoadFileParallel(path);
+    std::chrono::duration<double> parallelTotal = std::chrono::steady_clock::now() - start;
+
+    std::cout << "LoadFile phases over " << path << " (" << megabytes << " MB, "
+        << triangles << " triangles)" << std::endl;
+    print_phase("I/O", io, megabytes);
+    print_phase("tokenize", tokenize - io, megabytes);
+    print_phase("numbers", numbers - tokenize, megabytes);
+    print_phase("triangulation", triangulation, megabytes);
+    print_phase("assembly", total.count() - numbers - triangulation, megabytes);
+    print_phase("LoadFile", total.count(), megabytes);
+    print_phase("LoadFileMapped", mappedTotal.count(), megabytes);
+    print_phase("LoadFileParallel", parallelTotal.count(), megabytes);
+    std::cout << "  checksum " << checksum << std::endl;
+}
+
+///
+//  Generate and profile every face mix with and without
+//  vt/vn lines at the given size, removing each file after
+//
+int profile_suite(size_t bytes)
+{
+    const char* mixes[] = { "tri", "quad", "ngon", "mix" };
+    for (const char* faces : mixes)
+    {
+        for (int attributes = 0; attributes < 2; attributes++)
+        {
+            std::string path = std::string("bench_") + faces + (attributes ? "_ptn" : "_p") + ".obj";
+            if (!generate_obj(path, bytes, faces, attributes != 0, 1))
+            {
+                std::cerr << "Failed to write " << path << std::endl;
+                return 1;
+            }
+            profile_load_file(path);
+            std::remove(path.c_str());
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string command = argc > 1 ? argv[1] : "numbers";
+
+    if (command == "numbers")
+    {
+        size_t megabytes = argc > 2 ? std::stoul(argv[2]) : 64;
+        bench_numbers(megabytes);
+        return 0;
+    }
+    if (command == "triangulation")
+    {
+        return verify_triangulation();
+    }
+    if (command == "generate" && argc > 3)
+    {
+        std::string faces = argc > 4 ? argv[4] : "mix";
+        bool attributes = argc > 5 ? std::string(argv[5]) != "p" : true;
+        if (faces != "tri" && faces != "quad" && faces != "ngon" && faces != "mix")
+        {
+            std::cerr << "Unknown face mix " << faces << std::endl;
+            return 1;
+        }
+        if (!generate_obj(argv[2], parse_size(argv[3]), faces, attributes, 1))
+        {
+            std::cerr << "Failed to write " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "profile" && argc > 2)
+    {
+        profile_load_file(argv[2]);
+        return 0;
+    }
+    if (command == "suite")
+    {
+        return profile_suite(parse_size(argc > 2 ? argv[2] : "16M"));
+    }
+
+    std::cerr << "Usage: " << argv[0] << " numbers [megabytes]" << std::endl;
+    std::cerr << "       " << argv[0] << " triangulation" << std::endl;
+    std::cerr << "       " << argv[0] << " generate file.obj size [tri|quad|ngon|mix] [p|ptn]" << std::endl;
+    std::cerr << "       " << argv[0] << " profile file.obj" << std::endl;
+    std::cerr << "       " << argv[0] << " suite [size]" << std::endl;
+    return 1;
+}
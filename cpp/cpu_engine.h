@@ -0,0 +1,444 @@
+// cpu_engine.h - set_is_small and mesh normals on the CPU, for machines without OpenCL
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_ENGINE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Functions for an instruction set the build does not enable
+// everywhere, picked at runtime by cpu_detect_isa
+#if defined(__GNUC__)
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_TARGET(isa)
+#endif
+
+// Instruction sets the CPU engine has a path for
+enum cpu_isa { CPU_SCALAR, CPU_SSE, CPU_AVX2, CPU_AVX512 };
+
+// Triangles a thread classifies at least
+const size_t CPU_GRAIN = 1 << 14;
+
+///
+//  Name of an instruction set
+//
+inline const char* cpu_isa_name(cpu_isa isa)
+{
+    switch (isa)
+    {
+    case CPU_SSE:
+        return "SSE";
+    case CPU_AVX2:
+        return "AVX2";
+    case CPU_AVX512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+///
+//  The widest instruction set this CPU and OS can run
+//
+inline cpu_isa cpu_detect_isa()
+{
+#if defined(CPU_ENGINE_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return CPU_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return CPU_AVX2;
+    return CPU_SSE;
+#elif defined(CPU_ENGINE_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    __cpuidex(info, 7, 0);
+
+    // The OS must save the vector registers too
+    if ((info[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6)
+        return CPU_AVX512;
+    if ((info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6)
+        return CPU_AVX2;
+    return CPU_SSE;
+#else
+    return CPU_SCALAR;
+#endif
+}
+
+///
+//  Vertex positions as separate x, y and z arrays, so that
+//  vector lanes load one coordinate of several vertices
+//
+struct cpu_soa
+{
+    std::vector<float> x, y, z;
+};
+
+///
+//  Run f(first, last) over [0, count) split between threads,
+//  with at least grain items per thread
+//
+template <class F>
+void cpu_parallel_for(size_t count, size_t grain, unsigned threads, F f)
+{
+    size_t parts = std::max<size_t>(1, std::min<size_t>(threads, count / std::max<size_t>(grain, 1)));
+    if (parts == 1)
+    {
+        f((size_t)0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t step = (count + parts - 1) / parts;
+    for (size_t part = 1; part < parts; part++)
+        workers.emplace_back(f, std::min(count, part * step), std::min(count, (part + 1) * step));
+    f((size_t)0, std::min(count, step));
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+///
+//  Build the SoA view of count vertices stored four floats
+//  apart, as cl_float3 is
+//
+inline void cpu_make_soa(cpu_soa& soa, const float* vertices, size_t count, unsigned threads)
+{
+    soa.x.resize(count);
+    soa.y.resize(count);
+    soa.z.resize(count);
+    cpu_parallel_for(count, CPU_GRAIN, threads, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            soa.x[i] = vertices[i * 4];
+            soa.y[i] = vertices[i * 4 + 1];
+            soa.z[i] = vertices[i * 4 + 2];
+        }
+    });
+}
+
+///
+//  Whether an edge is shorter than min, computed as the
+//  kernel's distance()
+//
+inline bool cpu_edge_small(const cpu_soa& soa, uint32_t a, uint32_t b, float min)
+{
+    float dx = soa.x[a] - soa.x[b], dy = soa.y[a] - soa.y[b], dz = soa.z[a] - soa.z[b];
+    return sqrtf(dx * dx + dy * dy + dz * dz) < min;
+}
+
+///
+//  Classify triangles [first, last) one at a time, the
+//  triangles are four indices apart as cl_uint4 is. Returns
+//  the number of triangles flagged
+//
+inline size_t cpu_classify_scalar(uint32_t* triangles, size_t first, size_t last,
+    const cpu_soa& soa, float min)
+{
+    size_t flagged = 0;
+    for (size_t i = first; i < last; i++)
+    {
+        uint32_t* t = triangles + i * 4;
+        if (cpu_edge_small(soa, t[0], t[1], min) || cpu_edge_small(soa, t[1], t[2], min)
+            || cpu_edge_small(soa, t[0], t[2], min))
+        {
+            t[3] = 1;
+            flagged++;
+        }
+    }
+    return flagged;
+}
+
+#ifdef CPU_ENGINE_X86
+
+///
+//  Set the flags of the lanes in mask for the triangles
+//  from first on, returns how many there are
+//
+inline size_t cpu_flag_lanes(uint32_t* triangles, size_t first, unsigned mask)
+{
+    size_t flagged = 0;
+    for (unsigned lane = 0; mask != 0; lane++, mask >>= 1)
+    {
+        if (mask & 1)
+        {
+            triangles[(first + lane) * 4 + 3] = 1;
+            flagged++;
+        }
+    }
+    return flagged;
+}
+
+///
+//  cpu_classify_scalar four triangles at a time with SSE,
+//  loading the coordinates lane by lane
+//
+inline size_t cpu_classify_sse(uint32_t* triangles, size_t first, size_t last,
+    const cpu_soa& soa, float min)
+{
+    const float *X = soa.x.data(), *Y = soa.y.data(), *Z = soa.z.data();
+    __m128 limit = _mm_set1_ps(min);
+    size_t flagged = 0, i = first;
+
+    for (; i + 4 <= last; i += 4)
+    {
+        const uint32_t* t = triangles + i * 4;
+        __m128 p[3][3];
+        for (int v = 0; v < 3; v++)
+        {
+            p[v][0] = _mm_setr_ps(X[t[v]], X[t[4 + v]], X[t[8 + v]], X[t[12 + v]]);
+            p[v][1] = _mm_setr_ps(Y[t[v]], Y[t[4 + v]], Y[t[8 + v]], Y[t[12 + v]]);
+            p[v][2] = _mm_setr_ps(Z[t[v]], Z[t[4 + v]], Z[t[8 + v]], Z[t[12 + v]]);
+        }
+
+        __m128 small = _mm_setzero_ps();
+        const int edges[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+        for (const int* e : edges)
+        {
+            __m128 dx = _mm_sub_ps(p[e[0]][0], p[e[1]][0]);
+            __m128 dy = _mm_sub_ps(p[e[0]][1], p[e[1]][1]);
+            __m128 dz = _mm_sub_ps(p[e[0]][2], p[e[1]][2]);
+            __m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            small = _mm_or_ps(small, _mm_cmplt_ps(_mm_sqrt_ps(squared), limit));
+        }
+        flagged += cpu_flag_lanes(triangles, i, (unsigned)_mm_movemask_ps(small));
+    }
+
+    return flagged + cpu_classify_scalar(triangles, i, last, soa, min);
+}
+
+///
+//  cpu_classify_scalar eight triangles at a time with AVX2,
+//  gathering the indices and coordinates
+//
+CPU_TARGET("avx2")
+inline size_t cpu_classify_avx2(uint32_t* triangles, size_t first, size_t last,
+    const cpu_soa& soa, float min)
+{
+    const float *X = soa.x.data(), *Y = soa.y.data(), *Z = soa.z.data();
+    const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    __m256 limit = _mm256_set1_ps(min);
+    size_t flagged = 0, i = first;
+
+    for (; i + 8 <= last; i += 8)
+    {
+        const int* t = (const int*)(triangles + i * 4);
+        __m256 p[3][3];
+        for (int v = 0; v < 3; v++)
+        {
+            __m256i index = _mm256_i32gather_epi32(t + v, stride, 4);
+            p[v][0] = _mm256_i32gather_ps(X, index, 4);
+            p[v][1] = _mm256_i32gather_ps(Y, index, 4);
+            p[v][2] = _mm256_i32gather_ps(Z, index, 4);
+        }
+
+        __m256 small = _mm256_setzero_ps();
+        const int edges[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+        for (const int* e : edges)
+        {
+            __m256 dx = _mm256_sub_ps(p[e[0]][0], p[e[1]][0]);
+            __m256 dy = _mm256_sub_ps(p[e[0]][1], p[e[1]][1]);
+            __m256 dz = _mm256_sub_ps(p[e[0]][2], p[e[1]][2]);
+            __m256 squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                _mm256_mul_ps(dz, dz));
+            small = _mm256_or_ps(small, _mm256_cmp_ps(_mm256_sqrt_ps(squared), limit, _CMP_LT_OQ));
+        }
+        flagged += cpu_flag_lanes(triangles, i, (unsigned)_mm256_movemask_ps(small));
+    }
+
+    return flagged + cpu_classify_scalar(triangles, i, last, soa, min);
+}
+
+///
+//  cpu_classify_scalar sixteen triangles at a time with
+//  AVX-512, gathering the indices and coordinates
+//
+CPU_TARGET("avx512f")
+inline size_t cpu_classify_avx512(uint32_t* triangles, size_t first, size_t last,
+    const cpu_soa& soa, float min)
+{
+    const float *X = soa.x.data(), *Y = soa.y.data(), *Z = soa.z.data();
+    const __m512i stride = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28,
+        32, 36, 40, 44, 48, 52, 56, 60);
+    __m512 limit = _mm512_set1_ps(min);
+    size_t flagged = 0, i = first;
+
+    for (; i + 16 <= last; i += 16)
+    {
+        const int* t = (const int*)(triangles + i * 4);
+        __m512 p[3][3];
+        for (int v = 0; v < 3; v++)
+        {
+            __m512i index = _mm512_i32gather_epi32(stride, t + v, 4);
+            p[v][0] = _mm512_i32gather_ps(index, X, 4);
+            p[v][1] = _mm512_i32gather_ps(index, Y, 4);
+            p[v][2] = _mm512_i32gather_ps(index, Z, 4);
+        }
+
+        __mmask16 small = 0;
+        const int edges[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+        for (const int* e : edges)
+        {
+            __m512 dx = _mm512_sub_ps(p[e[0]][0], p[e[1]][0]);
+            __m512 dy = _mm512_sub_ps(p[e[0]][1], p[e[1]][1]);
+            __m512 dz = _mm512_sub_ps(p[e[0]][2], p[e[1]][2]);
+            __m512 squared = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                _mm512_mul_ps(dz, dz));
+            small |= _mm512_cmp_ps_mask(_mm512_sqrt_ps(squared), limit, _CMP_LT_OQ);
+        }
+        flagged += cpu_flag_lanes(triangles, i, (unsigned)small);
+    }
+
+    return flagged + cpu_classify_scalar(triangles, i, last, soa, min);
+}
+
+#endif
+
+///
+//  set_is_small on the CPU: flag in the fourth index of
+//  every triangle whether an edge is shorter than min,
+//  with the given instruction set, split between threads.
+//  Returns the number of triangles flagged
+//
+//  As the kernel, flags are only ever set, never cleared
+//
+inline size_t cpu_set_is_small(uint32_t* triangles, size_t count, const cpu_soa& soa,
+    float min, cpu_isa isa, unsigned threads)
+{
+    std::atomic<size_t> flagged(0);
+    cpu_parallel_for(count, CPU_GRAIN, threads, [&](size_t first, size_t last)
+    {
+        size_t found;
+        switch (isa)
+        {
+#ifdef CPU_ENGINE_X86
+        case CPU_AVX512:
+            found = cpu_classify_avx512(triangles, first, last, soa, min);
+            break;
+        case CPU_AVX2:
+            found = cpu_classify_avx2(triangles, first, last, soa, min);
+            break;
+        case CPU_SSE:
+            found = cpu_classify_sse(triangles, first, last, soa, min);
+            break;
+#endif
+        default:
+            found = cpu_classify_scalar(triangles, first, last, soa, min);
+            break;
+        }
+        flagged += found;
+    });
+    return flagged;
+}
+
+///
+//  Unit normal of each triangle into the first three of
+//  every four floats of normals, as cl_float3 is laid out,
+//  and its area into the fourth. Degenerate triangles get
+//  a zero normal and area, as face_normals in kernel.cl
+//
+inline void cpu_face_normals(float* normals, const uint32_t* triangles, size_t count,
+    const float* vertices, unsigned threads)
+{
+    cpu_parallel_for(count, CPU_GRAIN, threads, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            const uint32_t* t = triangles + i * 4;
+            const float *a = vertices + t[0] * 4, *b = vertices + t[1] * 4, *c = vertices + t[2] * 4;
+            float ux = b[0] - a[0], uy = b[1] - a[1], uz = b[2] - a[2];
+            float vx = c[0] - a[0], vy = c[1] - a[1], vz = c[2] - a[2];
+            float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+            float twice = sqrtf(nx * nx + ny * ny + nz * nz);
+
+            float* n = normals + i * 4;
+            if (twice > 0.0f)
+            {
+                n[0] = nx / twice;
+                n[1] = ny / twice;
+                n[2] = nz / twice;
+                n[3] = 0.5f * twice;
+            }
+            else
+                n[0] = n[1] = n[2] = n[3] = 0.0f;
+        }
+    });
+}
+
+///
+//  The triangles around each vertex, adjacent[offsets[v]]
+//  up to adjacent[offsets[v + 1]] in triangle order
+//
+inline void cpu_vertex_triangles(std::vector<uint32_t>& offsets, std::vector<uint32_t>& adjacent,
+    const uint32_t* triangles, size_t count, size_t vertexCount)
+{
+    offsets.assign(vertexCount + 1, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+            offsets[triangles[i * 4 + k] + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+    adjacent.resize(offsets[vertexCount]);
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+            adjacent[next[triangles[i * 4 + k]]++] = (uint32_t)i;
+    }
+}
+
+///
+//  Normal of each vertex as the unit sum of the normals of
+//  the faces around it weighted by their area, laid out as
+//  in cpu_face_normals with a zero fourth float. A vertex
+//  without triangles gets a zero normal
+//
+inline void cpu_vertex_normals(float* normals, const float* faceNormals,
+    const std::vector<uint32_t>& offsets, const std::vector<uint32_t>& adjacent,
+    size_t vertexCount, unsigned threads)
+{
+    cpu_parallel_for(vertexCount, CPU_GRAIN, threads, [&](size_t first, size_t last)
+    {
+        for (size_t v = first; v < last; v++)
+        {
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            for (uint32_t j = offsets[v]; j < offsets[v + 1]; j++)
+            {
+                const float* f = faceNormals + (size_t)adjacent[j] * 4;
+                x += f[0] * f[3];
+                y += f[1] * f[3];
+                z += f[2] * f[3];
+            }
+
+            float length = sqrtf(x * x + y * y + z * z);
+            float* n = normals + v * 4;
+            if (length > 0.0f)
+            {
+                n[0] = x / length;
+                n[1] = y / length;
+                n[2] = z / length;
+            }
+            else
+                n[0] = n[1] = n[2] = 0.0f;
+            n[3] = 0.0f;
+        }
+    });
+}
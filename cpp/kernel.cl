@@ -1,8 +1,13 @@
 __kernel void set_is_small(__global uint4 *triangles_array,
-    __global const float3 *verticles_array, __global const float *min)
+    __global const float3 *verticles_array, __global const float *min,
+    const uint triangles_size)
 {
     int gid = get_global_id(0);
 
+    // The global size is padded to the work-group size
+    if (gid >= triangles_size)
+        return;
+
     bool is_small = false;
 
     float3 x1 = { verticles_array[triangles_array[gid].x].x, verticles_array[triangles_array[gid].x].y, verticles_array[triangles_array[gid].x].z };
@@ -16,6 +21,302 @@ __kernel void set_is_small(__global uint4 *triangles_array,
     //printf("triangle %d: %d\ndistance: %f\nmin: %f", gid, triangles_array[gid].w, distance(x1, x2), *min);
 }
 
+// Reasons filter_triangles flags a triangle for, as bits of .w
+#define FILTER_SMALL 1
+#define FILTER_DEGENERATE 2
+#define FILTER_SLIVER 4
+#define FILTER_LONG 8
+#define FILTER_NORMAL 16
+#define FILTER_REASONS 5
+
+// Settings of filter_triangles, laid out as filter_params in
+// main.cpp
+typedef struct
+{
+    uint criteria;
+    float min_edge;
+    float min_area;
+    float max_aspect;
+    float max_edge;
+    float min_normal_cos;
+} filter_params;
+
+// Test every triangle against the enabled criteria in one pass
+// over the mesh, writing the reasons it is flagged for into .w
+// and adding them up per criterion into reason_counts:
+//  small - an edge shorter than min_edge, as set_is_small
+//  degenerate - repeated vertices or an area up to min_area
+//  sliver - longest edge over its altitude above max_aspect
+//  long - an edge longer than max_edge
+//  normal - the angle to the mean smooth normal of its
+//  vertices has a cosine below min_normal_cos
+__kernel void filter_triangles(__global uint4 *triangles_array,
+    __global const float3 *verticles_array, __constant filter_params *params,
+    const uint triangles_size, __global const float3 *normals,
+    __global uint *reason_counts)
+{
+    __local uint counts[FILTER_REASONS];
+    uint lid = get_local_id(0), size = get_local_size(0);
+    for (uint i = lid; i < FILTER_REASONS; i += size)
+        counts[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The global size is padded to the work-group size, the
+    // padding work-items still take part in the barriers
+    uint gid = get_global_id(0);
+    if (gid < triangles_size)
+    {
+        uint criteria = params->criteria;
+        uint4 t = triangles_array[gid];
+        float3 a = verticles_array[t.x], b = verticles_array[t.y], c = verticles_array[t.z];
+
+        float ab = distance(a, b), bc = distance(b, c), ca = distance(c, a);
+        float shortest = fmin(ab, fmin(bc, ca)), longest = fmax(ab, fmax(bc, ca));
+        float3 n = cross(b - a, c - a);
+        float area = 0.5f * length(n);
+
+        // Written so that NaN coordinates count as degenerate
+        bool degenerate = t.x == t.y || t.y == t.z || t.x == t.z || !(area > params->min_area);
+
+        uint reasons = 0;
+        if ((criteria & FILTER_SMALL) && shortest < params->min_edge)
+            reasons |= FILTER_SMALL;
+        if ((criteria & FILTER_DEGENERATE) && degenerate)
+            reasons |= FILTER_DEGENERATE;
+        if ((criteria & FILTER_SLIVER) && !degenerate
+            && longest * longest > params->max_aspect * 2.0f * area)
+            reasons |= FILTER_SLIVER;
+        if ((criteria & FILTER_LONG) && longest > params->max_edge)
+            reasons |= FILTER_LONG;
+        if ((criteria & FILTER_NORMAL) && !degenerate)
+        {
+            float3 smooth = normals[t.x] + normals[t.y] + normals[t.z];
+            if (dot(n, smooth) < params->min_normal_cos * length(n) * length(smooth))
+                reasons |= FILTER_NORMAL;
+        }
+
+        triangles_array[gid].w = reasons;
+        for (uint i = 0; i < FILTER_REASONS; i++)
+        {
+            if (reasons & (1u << i))
+                atomic_inc(&counts[i]);
+        }
+    }
+
+    // One global update per criterion and work-group
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint i = lid; i < FILTER_REASONS; i += size)
+    {
+        if (counts[i] != 0)
+            atomic_add(&reason_counts[i], counts[i]);
+    }
+}
+
+// Most thresholds sweep_thresholds takes, as SWEEP_MAX in
+// main.cpp
+#define SWEEP_MAX 64
+
+// Classify with several thresholds of set_is_small at once,
+// measuring each triangle once. The thresholds ascend, .w
+// gets 1 + the index of the first one the shortest edge is
+// under, 0 when under none, and level_counts the number of
+// triangles first flagged at each threshold
+__kernel void sweep_thresholds(__global uint4 *triangles_array,
+    __global const float3 *verticles_array, __global const float *thresholds,
+    const uint triangles_size, const uint threshold_count,
+    __global uint *level_counts)
+{
+    __local uint counts[SWEEP_MAX];
+    uint lid = get_local_id(0), size = get_local_size(0);
+    for (uint i = lid; i < threshold_count; i += size)
+        counts[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The padding work-items still take part in the barriers
+    uint gid = get_global_id(0);
+    if (gid < triangles_size)
+    {
+        uint4 t = triangles_array[gid];
+        float3 a = verticles_array[t.x], b = verticles_array[t.y], c = verticles_array[t.z];
+
+        // fmin skips NaN as the comparisons of set_is_small do
+        float shortest = fmin(distance(a, b), fmin(distance(b, c), distance(a, c)));
+
+        uint low = 0, high = threshold_count;
+        while (low < high)
+        {
+            uint middle = (low + high) / 2;
+            if (shortest < thresholds[middle])
+                high = middle;
+            else
+                low = middle + 1;
+        }
+
+        triangles_array[gid].w = low < threshold_count ? low + 1 : 0;
+        if (low < threshold_count)
+            atomic_inc(&counts[low]);
+    }
+
+    // One global update per threshold and work-group
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint i = lid; i < threshold_count; i += size)
+    {
+        if (counts[i] != 0)
+            atomic_add(&level_counts[i], counts[i]);
+    }
+}
+
+// Count the flagged triangles of each block of triangles,
+// one work-group per block
+__kernel void count_flagged(__global const uint4 *triangles_array,
+    const uint triangles_size, const uint block,
+    __global uint *group_counts, __local uint *scratch)
+{
+    uint lid = get_local_id(0), size = get_local_size(0), group = get_group_id(0);
+    uint first = group * block, last = min(first + block, triangles_size);
+
+    uint count = 0;
+    for (uint i = first + lid; i < last; i += size)
+        count += triangles_array[i].w != 0;
+    scratch[lid] = count;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // The work-group size is a power of two
+    for (uint step = size / 2; step > 0; step /= 2)
+    {
+        if (lid < step)
+            scratch[lid] += scratch[lid + step];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0)
+        group_counts[group] = scratch[0];
+}
+
+// Turn the block counts into the offsets of the blocks in the
+// output, with the total after the last block, run as a single
+// work-item since there are few blocks
+__kernel void scan_counts(__global uint *group_counts, const uint groups)
+{
+    uint sum = 0;
+    for (uint i = 0; i < groups; i++)
+    {
+        uint count = group_counts[i];
+        group_counts[i] = sum;
+        sum += count;
+    }
+    group_counts[groups] = sum;
+}
+
+// Write the indices of the flagged triangles of each block from
+// its offset on, in ascending order
+__kernel void write_flagged(__global const uint4 *triangles_array,
+    const uint triangles_size, const uint block,
+    __global const uint *group_offsets, __global uint *flagged,
+    __local uint *scratch)
+{
+    uint lid = get_local_id(0), size = get_local_size(0), group = get_group_id(0);
+    uint first = group * block, last = min(first + block, triangles_size);
+    uint base = group_offsets[group];
+
+    for (uint start = first; start < last; start += size)
+    {
+        uint i = start + lid;
+        uint flag = i < last && triangles_array[i].w != 0;
+        scratch[lid] = flag;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Inclusive scan of the flags over the work-group
+        for (uint step = 1; step < size; step *= 2)
+        {
+            uint add = lid >= step ? scratch[lid - step] : 0;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            scratch[lid] += add;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (flag)
+            flagged[base + scratch[lid] - 1] = i;
+        base += scratch[size - 1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+// Pack the flags of 32 triangles into each word of mask, the
+// flag of triangle i is bit i % 32 of word i / 32
+__kernel void pack_flags(__global const uint4 *triangles_array,
+    const uint triangles_size, __global uint *mask)
+{
+    uint gid = get_global_id(0);
+    uint first = gid * 32;
+    if (first >= triangles_size)
+        return;
+
+    uint last = min(first + 32, triangles_size), word = 0;
+    for (uint i = first; i < last; i++)
+    {
+        if (triangles_array[i].w != 0)
+            word |= 1u << (i - first);
+    }
+    mask[gid] = word;
+}
+
+// Unit normal of each triangle into the first three of
+// every four floats of normals and its area into the fourth,
+// zero for degenerate triangles, as cpu_face_normals
+__kernel void face_normals(__global const uint4 *triangles_array,
+    __global const float3 *verticles_array, __global float *normals,
+    const uint triangles_size)
+{
+    uint gid = get_global_id(0);
+    if (gid >= triangles_size)
+        return;
+
+    uint4 t = triangles_array[gid];
+    float3 a = verticles_array[t.x], b = verticles_array[t.y], c = verticles_array[t.z];
+    float3 n = cross(b - a, c - a);
+    float twice = length(n);
+
+    __global float *target = normals + 4 * gid;
+    if (twice > 0.0f)
+    {
+        target[0] = n.x / twice;
+        target[1] = n.y / twice;
+        target[2] = n.z / twice;
+        target[3] = 0.5f * twice;
+    }
+    else
+        target[0] = target[1] = target[2] = target[3] = 0.0f;
+}
+
+// Normal of each vertex as the unit sum of the face normals
+// around it, adjacent[offsets[v]] up to
+// adjacent[offsets[v + 1]], weighted by area
+__kernel void vertex_normals(__global const uint *offsets,
+    __global const uint *adjacent, __global const float *face_normals,
+    __global float *normals, const uint vertices_size)
+{
+    uint gid = get_global_id(0);
+    if (gid >= vertices_size)
+        return;
+
+    float3 sum = { 0.0f, 0.0f, 0.0f };
+    for (uint j = offsets[gid]; j < offsets[gid + 1]; j++)
+    {
+        __global const float *f = face_normals + 4 * adjacent[j];
+        sum.x += f[0] * f[3];
+        sum.y += f[1] * f[3];
+        sum.z += f[2] * f[3];
+    }
+
+    float sumLength = length(sum);
+    __global float *target = normals + 4 * gid;
+    target[0] = sumLength > 0.0f ? sum.x / sumLength : 0.0f;
+    target[1] = sumLength > 0.0f ? sum.y / sumLength : 0.0f;
+    target[2] = sumLength > 0.0f ? sum.z / sumLength : 0.0f;
+    target[3] = 0.0f;
+}
+
 __kernel void sort_distances(__global float3 *distances,
     __global uint3 *triangles_array,
     __global const uint *triangles_size)
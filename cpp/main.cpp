@@ -4,14 +4,38 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cfloat>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iomanip>
+#include <iterator>
+#include <vector>
 #include "OBJ_Loader.h"
+#include "cpu_engine.h"
+#include "simplify.h"
 
 #include <CL/cl.h>
+#include <GL/glew.h>
 #include <D:/Program Files (x86)/Common Files/MSVC/freeglut/include/GL/glut.h>
 
 size_t triangles_number = 0, verticles_number = 0;
-cl_uint4* triangles_array = new cl_uint4[1];
-cl_float3* verticles_array = new cl_float3[1];
+cl_uint4* triangles_array = NULL;
+cl_float3* verticles_array = NULL;
+
+// Normals of the loaded mesh from compute_normals: per
+// triangle with its area in .w, and per vertex weighted by
+// the areas around it
+std::vector<cl_float3> face_normals, smooth_normals;
+
+// Set by --device-normals: the normals are computed by
+// kernels after loading instead of on the CPU
+bool device_normals = false;
 
 const struct OBJ_COLOR {
     GLfloat red, green, blue;
@@ -20,6 +44,70 @@ const struct OBJ_COLOR {
 
 bool render_mode; // true = solid body, false = wireframe
 
+// Triangles classified at once with --stream
+const size_t STREAM_BATCH = 1 << 20;
+
+// Tuned local work sizes, one line per device and kernel
+const char* TUNING_FILE = "3d-check.tuning";
+
+// Where --profile writes the timings of the run
+const char* PROFILE_FILE = "3d-check.profile.json";
+
+// Set by --simplify: the loaded mesh is simplified to this
+// share of its triangles before it is classified, and
+// written to SIMPLIFIED_FILE
+double simplify_ratio = 0.0;
+const char* SIMPLIFIED_FILE = "3d-check.simplified.obj";
+
+// Options every kernel program is built with
+const char* BUILD_OPTIONS = "";
+
+// Triangles per transfer when the device has its own memory
+const size_t PIPELINE_CHUNK = 1 << 18;
+
+// Alignment of the mesh arrays, enough for the devices to
+// use them in place
+const size_t HOST_ALIGNMENT = 4096;
+
+// How the flags of the triangles come back from the device:
+// the whole triangle buffer, the indices of the flagged
+// triangles, or one bit per triangle
+enum output_mode { OUTPUT_FULL, OUTPUT_INDICES, OUTPUT_BITMASK };
+
+// Triangles each work-group of the compaction kernels covers
+const size_t COMPACT_BLOCK = 4096;
+
+// Memory objects of a kernel: triangles, vertices, min,
+// filter settings or thresholds, for filter_triangles the
+// vertex normals and the counts per reason, and for
+// sweep_thresholds the counts per threshold
+const int MEM_OBJECTS = 5;
+
+// Most thresholds one launch of sweep_thresholds takes, as
+// SWEEP_MAX in kernel.cl
+const size_t SWEEP_MAX = 64;
+
+// Reasons filter_triangles flags a triangle for, as bits of .w
+enum filter_reason
+{
+    FILTER_SMALL = 1,
+    FILTER_DEGENERATE = 2,
+    FILTER_SLIVER = 4,
+    FILTER_LONG = 8,
+    FILTER_NORMAL = 16
+};
+const int FILTER_REASONS = 5;
+const char* FILTER_NAMES[FILTER_REASONS] = { "small", "degenerate", "sliver", "long", "normal" };
+
+// Settings of filter_triangles, laid out as in kernel.cl
+struct filter_params
+{
+    cl_uint criteria;
+    cl_float min_edge, min_area, max_aspect, max_edge, min_normal_cos;
+    filter_params() : criteria(0), min_edge(0.05f), min_area(1e-12f),
+        max_aspect(20.0f), max_edge(1.0f), min_normal_cos(0.5f) {}
+};
+
 const float ZOOM_SPEED = 0.1f;
 const float ROTATE_SPEED = 0.1f;
 float       DISTANCE = 4.0f;
@@ -30,6 +118,8 @@ struct camera
     camera() : x(-4.0f), y(2.0f), z(0.0f), phi(0), theta(0) {}
 } camera;
 
+int window_width = 960, window_height = 720;
+
 void init()
 {
     glShadeModel(GL_SMOOTH);
@@ -60,36 +150,206 @@ void init()
 
 }
 
-void calculate_normal(cl_uint3 f, GLdouble* normal, cl_float3* vertices)
+// Triangles per leaf of the BVH, each leaf is a chunk of
+// the index buffer that is culled or drawn whole
+const size_t BVH_LEAF = 4096;
+
+// Node of a BVH, with the bounds of its triangles. The
+// nodes are in depth-first order, so the first child of an
+// inner node follows it and the leaves under any node are
+// consecutive
+struct bvh_node
+{
+    float lower[3], upper[3];
+    cl_uint right;                  // second child, 0 for a leaf
+    cl_uint firstLeaf, lastLeaf;    // leaves [firstLeaf, lastLeaf) under it
+};
+
+// Bounding volume hierarchy over the triangles of a mesh:
+// the triangles of leaf l are order[leafFirst[l]] up to
+// order[leafFirst[l + 1]], and visible has the leaves that
+// passed the last cull in ascending order
+struct bvh_tree
+{
+    std::vector<bvh_node> nodes;
+    std::vector<cl_uint> order, leafFirst, visible;
+    size_t visibleTriangles;
+    double cullMs;
+    bvh_tree() : visibleTriangles(0), cullMs(0.0) {}
+};
+
+///
+//  Add the node over order[first, last) and the nodes under
+//  it, splitting at the median centroid along the longest
+//  side of its bounds
+//
+void build_bvh_node(bvh_tree& bvh, size_t first, size_t last, const cl_uint4* triangles,
+    const cl_float3* vertices, const std::vector<float>& centroids)
+{
+    size_t index = bvh.nodes.size();
+    bvh_node node;
+    for (int k = 0; k < 3; k++)
+    {
+        node.lower[k] = FLT_MAX;
+        node.upper[k] = -FLT_MAX;
+    }
+    for (size_t j = first; j < last; j++)
+    {
+        const cl_uint4& t = triangles[bvh.order[j]];
+        for (cl_uint v : { t.x, t.y, t.z })
+        {
+            const float* p = &vertices[v].x;
+            for (int k = 0; k < 3; k++)
+            {
+                node.lower[k] = std::min(node.lower[k], p[k]);
+                node.upper[k] = std::max(node.upper[k], p[k]);
+            }
+        }
+    }
+    node.right = 0;
+    node.firstLeaf = (cl_uint)bvh.leafFirst.size();
+    bvh.nodes.push_back(node);
+
+    if (last - first <= BVH_LEAF)
+    {
+        bvh.leafFirst.push_back((cl_uint)first);
+        bvh.nodes[index].lastLeaf = (cl_uint)bvh.leafFirst.size();
+        return;
+    }
+
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+    {
+        if (node.upper[k] - node.lower[k] > node.upper[axis] - node.lower[axis])
+            axis = k;
+    }
+    size_t middle = first + (last - first) / 2;
+    std::nth_element(bvh.order.begin() + first, bvh.order.begin() + middle, bvh.order.begin() + last,
+        [&](cl_uint a, cl_uint b) { return centroids[3 * a + axis] < centroids[3 * b + axis]; });
+
+    build_bvh_node(bvh, first, middle, triangles, vertices, centroids);
+    bvh.nodes[index].right = (cl_uint)bvh.nodes.size();
+    build_bvh_node(bvh, middle, last, triangles, vertices, centroids);
+    bvh.nodes[index].lastLeaf = (cl_uint)bvh.leafFirst.size();
+}
+
+///
+//  Build the BVH of a mesh and report how long it took
+//
+void build_bvh(bvh_tree& bvh, const cl_uint4* triangles, size_t count, const cl_float3* vertices)
 {
-    // x
-    normal[0] = (vertices[f.y].y - vertices[f.x].y) * (vertices[f.z].z - vertices[f.x].z)
-        - (vertices[f.z].y - vertices[f.x].y) * (vertices[f.y].z - vertices[f.x].z);
-    // y
-    normal[1] = (vertices[f.y].z - vertices[f.x].z) * (vertices[f.z].x - vertices[f.x].x)
-        - (vertices[f.z].x - vertices[f.x].x) * (vertices[f.z].z - vertices[f.x].z);
-    // z
-    normal[2] = (vertices[f.y].x - vertices[f.x].x) * (vertices[f.z].y - vertices[f.x].y)
-        - (vertices[f.z].x - vertices[f.x].x) * (vertices[f.y].y - vertices[f.x].y);
+    auto start = std::chrono::steady_clock::now();
+    bvh.nodes.clear();
+    bvh.leafFirst.clear();
+    bvh.visible.clear();
+    bvh.order.resize(count);
+
+    std::vector<float> centroids(3 * count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const cl_uint4& t = triangles[i];
+        const cl_float3 &a = vertices[t.x], &b = vertices[t.y], &c = vertices[t.z];
+        centroids[3 * i] = (a.x + b.x + c.x) / 3.0f;
+        centroids[3 * i + 1] = (a.y + b.y + c.y) / 3.0f;
+        centroids[3 * i + 2] = (a.z + b.z + c.z) / 3.0f;
+        bvh.order[i] = (cl_uint)i;
+    }
+
+    if (count > 0)
+        build_bvh_node(bvh, 0, count, triangles, vertices, centroids);
+    bvh.leafFirst.push_back((cl_uint)count);
+
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    std::cout << "Built a BVH of " << bvh.nodes.size() << " nodes and " << bvh.leafFirst.size() - 1
+        << " chunks over " << count << " triangles in " << ms.count() << " ms." << std::endl;
 }
 
-void draw_obj(cl_uint4* triangles, cl_float3* vertices,
-    size_t triangles_size, size_t verticles_size)
+///
+//  Find the leaves of the BVH inside or crossing the view
+//  frustum of the current projection and modelview
+//
+void cull_bvh(bvh_tree& bvh)
 {
-    if (render_mode)
+    auto start = std::chrono::steady_clock::now();
+
+    // The planes of the frustum are sums and differences of
+    // the rows of the clip matrix, positive inside
+    GLfloat projection[16], modelview[16], clip[16], planes[6][4];
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    for (int column = 0; column < 4; column++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            clip[column * 4 + row] = 0.0f;
+            for (int k = 0; k < 4; k++)
+                clip[column * 4 + row] += projection[k * 4 + row] * modelview[column * 4 + k];
+        }
+    }
+    for (int plane = 0; plane < 6; plane++)
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+        for (int column = 0; column < 4; column++)
+            planes[plane][column] = clip[column * 4 + 3] + sign * clip[column * 4 + plane / 2];
     }
-    else
+
+    bvh.visible.clear();
+    std::vector<cl_uint> stack;
+    if (!bvh.nodes.empty())
+        stack.push_back(0);
+    while (!stack.empty())
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        const bvh_node& node = bvh.nodes[stack.back()];
+        cl_uint index = stack.back();
+        stack.pop_back();
+
+        // Outside when the corner furthest along a plane is
+        // behind it, inside when the nearest corner is in
+        // front of every plane
+        bool outside = false, inside = true;
+        for (int plane = 0; plane < 6 && !outside; plane++)
+        {
+            float furthest = planes[plane][3], nearest = planes[plane][3];
+            for (int k = 0; k < 3; k++)
+            {
+                float a = planes[plane][k] * node.lower[k], b = planes[plane][k] * node.upper[k];
+                furthest += std::max(a, b);
+                nearest += std::min(a, b);
+            }
+            outside = furthest < 0.0f;
+            inside = inside && nearest >= 0.0f;
+        }
+
+        if (outside)
+            continue;
+        if (inside || node.right == 0)
+        {
+            for (cl_uint leaf = node.firstLeaf; leaf < node.lastLeaf; leaf++)
+                bvh.visible.push_back(leaf);
+            continue;
+        }
+        stack.push_back(node.right);
+        stack.push_back(index + 1);
     }
-    for (int i = 0; i < triangles_size; i++)
+
+    bvh.visibleTriangles = 0;
+    for (cl_uint leaf : bvh.visible)
+        bvh.visibleTriangles += bvh.leafFirst[leaf + 1] - bvh.leafFirst[leaf];
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    bvh.cullMs = ms.count();
+}
+
+///
+//  Draw the triangles order[0, count) one at a time
+//
+void draw_obj(cl_uint4* triangles, cl_float3* vertices, const cl_float3* normals,
+    const cl_uint* order, size_t count)
+{
+    for (size_t j = 0; j < count; j++)
     {
-        GLdouble normal[3];
-        calculate_normal(triangles[i], normal, vertices);
+        size_t i = order[j];
         glBegin(GL_TRIANGLES);
-        if (triangles[i].w == 1)
+        if (triangles[i].w != 0)
         {
             glColor3f(OBJ_COLOR.red, 0.0, 0.0);
         }
@@ -97,16 +357,546 @@ void draw_obj(cl_uint4* triangles, cl_float3* vertices,
         {
             glColor3f(OBJ_COLOR.red, OBJ_COLOR.green, OBJ_COLOR.blue);
         }
-        glNormal3dv(normal);
+        glNormal3f(normals[i].x, normals[i].y, normals[i].z);
         glVertex3d(vertices[triangles[i].x].x, vertices[triangles[i].x].y, vertices[triangles[i].x].z);
         glVertex3d(vertices[triangles[i].y].x, vertices[triangles[i].y].y, vertices[triangles[i].y].z);
         glVertex3d(vertices[triangles[i].z].x, vertices[triangles[i].z].y, vertices[triangles[i].z].z);
         glEnd();
     }
+}
+
+// Retained-mode copy of a level of the mesh on the GPU,
+// uploaded once after classification: the vertices and
+// their normals, and the indices of the unflagged triangles
+// followed by the flagged ones, both in BVH leaf order. The
+// indices of leaf l start at unflaggedStart[l] and
+// flaggedStart[l] of their half
+struct mesh_buffers
+{
+    GLuint vertices, normals, indices;
+    GLsizei unflagged, flagged;
+    std::vector<GLsizei> unflaggedStart, flaggedStart;
+    bool ready;
+    mesh_buffers() : vertices(0), normals(0), indices(0),
+        unflagged(0), flagged(0), ready(false) {}
+};
+
+// Levels of detail the viewer has at most, the share of the
+// triangles of a level the next one keeps, and the fewest
+// triangles a level is simplified from
+const size_t LOD_LEVELS = 4;
+const double LOD_RATIO = 0.25;
+const size_t LOD_MIN_TRIANGLES = 1 << 12;
+
+// Most pixels the surface of the level drawn may stray from
+// the loaded mesh on screen
+const double LOD_PIXELS = 1.0;
+
+// Triangles above which the viewer shows only the loaded
+// mesh unless --lod asks for the coarser levels, which take
+// some 400 bytes per triangle of it to build
+const size_t LOD_MAX_TRIANGLES = 1 << 22;
+
+// How often, in ms, the viewer looks for the coarser levels
+// while they are built
+const unsigned LOD_POLL_MS = 100;
+
+// Set by --lod: the coarser levels are built whatever the
+// size of the mesh
+bool force_lods = false;
+
+// A level of detail of the mesh shown. Level 0 is the
+// loaded mesh and points at its arrays, each further level
+// is simplified from the one before by qem_simplify and
+// owns its arrays, with source mapping its triangles back
+// to the loaded ones for their flags. error is the most,
+// in mesh units, the level strays from the loaded mesh
+struct mesh_level
+{
+    cl_uint4* triangles;
+    cl_float3* vertices;
+    const cl_float3 *faceNormals, *smoothNormals;
+    size_t triangleCount, vertexCount;
+    std::vector<cl_uint4> ownTriangles;
+    std::vector<cl_float3> ownVertices, ownFaceNormals, ownSmoothNormals;
+    std::vector<cl_uint> source;
+    double error;
+    bvh_tree bvh;
+    mesh_buffers buffers;
+    mesh_level() : triangles(NULL), vertices(NULL), faceNormals(NULL), smoothNormals(NULL),
+        triangleCount(0), vertexCount(0), error(0.0) {}
+};
+
+// The levels from finest to coarsest, and the one drawn last
+std::vector<mesh_level> mesh_levels;
+size_t mesh_lod = 0;
+
+// Coarser levels built by the worker of build_lods, handed
+// over to mesh_levels by adopt_lods once lods_built is set
+std::vector<mesh_level> built_lods;
+std::atomic<bool> lods_built(false);
+
+///
+//  Order the triangle indices of a level by flag, so each
+//  colour is one draw call
+//
+void upload_flag_indices(mesh_level& level)
+{
+    const bvh_tree& bvh = level.bvh;
+    mesh_buffers& buffers = level.buffers;
+    size_t count = level.triangleCount, flagged = 0;
+    for (size_t i = 0; i < count; i++)
+        flagged += level.triangles[i].w != 0;
+
+    size_t leaves = bvh.leafFirst.size() - 1;
+    buffers.unflaggedStart.resize(leaves + 1);
+    buffers.flaggedStart.resize(leaves + 1);
+    std::vector<GLuint> indices(3 * count);
+    size_t next[2] = { 0, 3 * (count - flagged) };
+    for (size_t leaf = 0; leaf <= leaves; leaf++)
+    {
+        buffers.unflaggedStart[leaf] = (GLsizei)next[0];
+        buffers.flaggedStart[leaf] = (GLsizei)(next[1] - 3 * (count - flagged));
+        if (leaf == leaves)
+            break;
+
+        for (cl_uint j = bvh.leafFirst[leaf]; j < bvh.leafFirst[leaf + 1]; j++)
+        {
+            const cl_uint4& t = level.triangles[bvh.order[j]];
+            GLuint* target = &indices[next[t.w != 0]];
+            target[0] = t.x;
+            target[1] = t.y;
+            target[2] = t.z;
+            next[t.w != 0] += 3;
+        }
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    buffers.unflagged = (GLsizei)(3 * (count - flagged));
+    buffers.flagged = (GLsizei)(3 * flagged);
+}
+
+///
+//  Upload the vertices, normals and triangle indices of a
+//  level into buffer objects
+//
+bool upload_level(mesh_level& level)
+{
+    // Only errors of the upload count
+    while (glGetError() != GL_NO_ERROR)
+        ;
+
+    mesh_buffers& buffers = level.buffers;
+    glGenBuffers(1, &buffers.vertices);
+    glGenBuffers(1, &buffers.normals);
+    glGenBuffers(1, &buffers.indices);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cl_float3) * level.vertexCount, level.vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.normals);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cl_float3) * level.vertexCount, level.smoothNormals, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    upload_flag_indices(level);
+
+    buffers.ready = glGetError() == GL_NO_ERROR;
+    return buffers.ready;
+}
+
+///
+//  Upload the loaded mesh into buffer objects, false when
+//  the GL has none
+//
+bool upload_mesh()
+{
+    if (glewInit() != GLEW_OK || !GLEW_VERSION_1_5)
+    {
+        std::cout << "No OpenGL buffer objects, drawing triangle by triangle." << std::endl;
+        return false;
+    }
+
+    bool ready = upload_level(mesh_levels[0]);
+    if (!ready)
+        std::cout << "Failed to upload the mesh, drawing triangle by triangle." << std::endl;
+    return ready;
+}
+
+///
+//  Draw a level of the mesh from its buffer objects, one
+//  call for the unflagged and one for the flagged
+//  triangles, or triangle by triangle without them
+//
+void draw_mesh(mesh_level& level)
+{
+    bvh_tree& bvh = level.bvh;
+    mesh_buffers& buffers = level.buffers;
+    cull_bvh(bvh);
+
+    // Consecutive visible leaves are one range of triangles
+    std::vector<std::pair<cl_uint, cl_uint>> runs;
+    for (cl_uint leaf : bvh.visible)
+    {
+        if (!runs.empty() && runs.back().second == leaf)
+            runs.back().second++;
+        else
+            runs.push_back(std::make_pair(leaf, leaf + 1));
+    }
+
+    glPolygonMode(GL_FRONT_AND_BACK, render_mode ? GL_FILL : GL_LINE);
+    if (!buffers.ready)
+    {
+        for (const auto& run : runs)
+        {
+            cl_uint first = bvh.leafFirst[run.first];
+            draw_obj(level.triangles, level.vertices, level.faceNormals, &bvh.order[first],
+                bvh.leafFirst[run.second] - first);
+        }
+        glFlush();
+        return;
+    }
+
+    // One multi-draw per colour over the ranges of the runs
+    std::vector<GLsizei> counts[2];
+    std::vector<const GLvoid*> offsets[2];
+    for (const auto& run : runs)
+    {
+        const std::vector<GLsizei>* starts[2] = { &buffers.unflaggedStart, &buffers.flaggedStart };
+        for (int half = 0; half < 2; half++)
+        {
+            GLsizei first = (*starts[half])[run.first], count = (*starts[half])[run.second] - first;
+            if (half == 1)
+                first += buffers.unflagged;
+            if (count == 0)
+                continue;
+            counts[half].push_back(count);
+            offsets[half].push_back((const GLvoid*)(sizeof(GLuint) * first));
+        }
+    }
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+    glVertexPointer(3, GL_FLOAT, sizeof(cl_float3), 0);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.normals);
+    glNormalPointer(GL_FLOAT, sizeof(cl_float3), 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indices);
+
+    glColor3f(OBJ_COLOR.red, OBJ_COLOR.green, OBJ_COLOR.blue);
+    glMultiDrawElements(GL_TRIANGLES, counts[0].data(), GL_UNSIGNED_INT,
+        offsets[0].data(), (GLsizei)counts[0].size());
+    glColor3f(OBJ_COLOR.red, 0.0, 0.0);
+    glMultiDrawElements(GL_TRIANGLES, counts[1].data(), GL_UNSIGNED_INT,
+        offsets[1].data(), (GLsizei)counts[1].size());
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
     glFlush();
 }
 
+///
+//  Make the loaded mesh level 0, the only one drawn until
+//  the coarser levels are built
+//
+void init_lods()
+{
+    mesh_levels.clear();
+    mesh_levels.reserve(LOD_LEVELS);
+    mesh_levels.emplace_back();
+    mesh_level& finest = mesh_levels.back();
+    finest.triangles = triangles_array;
+    finest.vertices = verticles_array;
+    finest.faceNormals = face_normals.data();
+    finest.smoothNormals = smooth_normals.data();
+    finest.triangleCount = triangles_number;
+    finest.vertexCount = verticles_number;
+    build_bvh(finest.bvh, triangles_array, triangles_number, verticles_array);
+}
+
+///
+//  Simplify level 0 into up to LOD_LEVELS - 1 coarser levels
+//  in built_lods, each from the one before with LOD_RATIO of
+//  its triangles, with their normals and BVH, and report how
+//  long it took. Runs on a thread of its own while the
+//  viewer draws level 0, which it only reads
+//
+void build_lods()
+{
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    auto start = std::chrono::steady_clock::now();
+    const mesh_level* coarse = &mesh_levels[0];
+    while (1 + built_lods.size() < LOD_LEVELS && coarse->triangleCount * LOD_RATIO >= LOD_MIN_TRIANGLES)
+    {
+        qem_mesh simplified;
+        qem_simplify(simplified, (const uint32_t*)coarse->triangles, coarse->triangleCount,
+            (const float*)coarse->vertices, coarse->vertexCount, LOD_RATIO, threads, (int)(1 + built_lods.size()));
+
+        // Levels that hardly shrink are not worth drawing
+        size_t count = simplified.triangles.size() / 4;
+        if (count == 0 || count > coarse->triangleCount * (1.0 + LOD_RATIO) / 2.0)
+            break;
+
+        mesh_level level;
+        level.triangleCount = count;
+        level.vertexCount = simplified.vertices.size() / 4;
+        level.ownTriangles.resize(count);
+        level.ownVertices.resize(level.vertexCount);
+        memcpy(level.ownTriangles.data(), simplified.triangles.data(), sizeof(cl_uint4) * count);
+        memcpy(level.ownVertices.data(), simplified.vertices.data(), sizeof(cl_float3) * level.vertexCount);
+        level.source.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            cl_uint from = level.ownTriangles[i].w;
+            level.source[i] = coarse->source.empty() ? from : coarse->source[from];
+            level.ownTriangles[i].w = triangles_array[level.source[i]].w;
+        }
+        level.error = coarse->error + simplified.error;
+
+        level.ownFaceNormals.resize(count);
+        level.ownSmoothNormals.resize(level.vertexCount);
+        cpu_face_normals((float*)level.ownFaceNormals.data(), (const uint32_t*)level.ownTriangles.data(), count,
+            (const float*)level.ownVertices.data(), threads);
+        std::vector<uint32_t> offsets, adjacent;
+        cpu_vertex_triangles(offsets, adjacent, (const uint32_t*)level.ownTriangles.data(), count,
+            level.vertexCount);
+        cpu_vertex_normals((float*)level.ownSmoothNormals.data(), (const float*)level.ownFaceNormals.data(),
+            offsets, adjacent, level.vertexCount, threads);
+
+        level.triangles = level.ownTriangles.data();
+        level.vertices = level.ownVertices.data();
+        level.faceNormals = level.ownFaceNormals.data();
+        level.smoothNormals = level.ownSmoothNormals.data();
+        build_bvh(level.bvh, level.triangles, count, level.vertices);
+        built_lods.push_back(std::move(level));
+        coarse = &built_lods.back();
+    }
+
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    std::cout << "Built " << built_lods.size() << " coarser levels in " << ms.count() << " ms:";
+    for (const mesh_level& level : built_lods)
+        std::cout << " " << level.triangleCount << " (error " << level.error << ")";
+    std::cout << std::endl;
+    lods_built = true;
+}
+
+///
+//  Start building the coarser levels of the loaded mesh,
+//  false when it has more than LOD_MAX_TRIANGLES and --lod
+//  was not given
+//
+bool start_lods()
+{
+    if (triangles_number > LOD_MAX_TRIANGLES && !force_lods)
+    {
+        std::cout << "Showing all " << triangles_number << " triangles without coarser levels, "
+            << "--lod builds them." << std::endl;
+        return false;
+    }
+    built_lods.clear();
+    built_lods.reserve(LOD_LEVELS);
+    lods_built = false;
+    std::thread(build_lods).detach();
+    return true;
+}
+
+///
+//  Timer of the viewer: once the coarser levels are built,
+//  upload them and redraw with them, otherwise look again
+//  after LOD_POLL_MS
+//
+void adopt_lods(int value)
+{
+    if (!lods_built)
+    {
+        glutTimerFunc(LOD_POLL_MS, adopt_lods, value);
+        return;
+    }
+
+    for (mesh_level& level : built_lods)
+    {
+        mesh_levels.push_back(std::move(level));
+        if (mesh_levels[0].buffers.ready && !upload_level(mesh_levels.back()))
+            std::cout << "Failed to upload level " << mesh_levels.size() - 1
+                << ", drawing it triangle by triangle." << std::endl;
+    }
+    built_lods.clear();
+    glutPostRedisplay();
+}
+
+///
+//  How many pixels an error in mesh units at distance covers
+//  with the projection of reshape
+//
+double error_pixels(double error, double distance)
+{
+    return error * window_height / (2.0 * std::max(distance, 1.0) * tan(40.0 * 3.14159265358979 / 180.0));
+}
+
+///
+//  Pick the coarsest level whose error stays within
+//  LOD_PIXELS on screen, measured at the point of the
+//  bounds of the mesh nearest to the camera
+//
+size_t select_lod()
+{
+    const bvh_tree& bvh = mesh_levels[0].bvh;
+    if (bvh.nodes.empty())
+        return 0;
+
+    const bvh_node& root = bvh.nodes[0];
+    GLfloat eye[3] = { camera.x, camera.y, camera.z };
+    double distance = 0.0;
+    for (int k = 0; k < 3; k++)
+    {
+        double outside = std::max(0.0, std::max((double)root.lower[k] - eye[k], (double)eye[k] - root.upper[k]));
+        distance += outside * outside;
+    }
+    distance = sqrt(distance);
+
+    size_t lod = 0;
+    for (size_t l = 1; l < mesh_levels.size(); l++)
+    {
+        if (error_pixels(mesh_levels[l].error, distance) <= LOD_PIXELS)
+            lod = l;
+    }
+    return lod;
+}
+
+// Frames the percentiles of the HUD cover, and GPU timer
+// queries in flight so reading one never waits on the GPU
+const size_t HUD_FRAMES = 120;
+const int HUD_QUERIES = 4;
+
+// Frame-time HUD, toggled with 'h' or shown from the start
+// with --hud. While shown the viewer keeps redrawing to
+// keep measuring
+struct frame_stats
+{
+    bool shown, timed;
+    GLuint queries[HUD_QUERIES];
+    unsigned long frame;
+    std::deque<double> cpu, gpu;
+    frame_stats() : shown(false), timed(false), frame(0) {}
+} frame_stats;
+
+///
+//  Create the GPU timer queries when the GL has them, after
+//  upload_mesh loaded the extensions
+//
+void init_frame_stats()
+{
+    frame_stats.timed = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (frame_stats.timed)
+        glGenQueries(HUD_QUERIES, frame_stats.queries);
+}
+
+///
+//  Add a frame time in ms to the last HUD_FRAMES of them
+//
+void push_frame_time(std::deque<double>& times, double ms)
+{
+    times.push_back(ms);
+    if (times.size() > HUD_FRAMES)
+        times.pop_front();
+}
+
+///
+//  The p-th percentile of frame times, 0 without any
+//
+double percentile(const std::deque<double>& times, double p)
+{
+    if (times.empty())
+        return 0.0;
+    std::vector<double> sorted(times.begin(), times.end());
+    size_t rank = std::min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+///
+//  Time the drawing of the mesh on the GPU. The query of
+//  the frame HUD_QUERIES - 1 back is read once its result
+//  is there, and skipped otherwise
+//
+void begin_frame_query()
+{
+    if (!frame_stats.shown || !frame_stats.timed)
+        return;
+
+    GLuint oldest = frame_stats.queries[(frame_stats.frame + 1) % HUD_QUERIES];
+    if (frame_stats.frame + 1 >= HUD_QUERIES)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(oldest, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(oldest, GL_QUERY_RESULT, &elapsed);
+            push_frame_time(frame_stats.gpu, elapsed * 1e-6);
+        }
+    }
+    glBeginQuery(GL_TIME_ELAPSED, frame_stats.queries[frame_stats.frame % HUD_QUERIES]);
+}
+
+void end_frame_query()
+{
+    if (!frame_stats.shown || !frame_stats.timed)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    frame_stats.frame++;
+}
+
+///
+//  Print the level drawn, its triangle count and the frame
+//  times over the mesh, in window coordinates
+//
+void draw_hud()
+{
+    std::ostringstream lines[3];
+    const mesh_level& level = mesh_levels[mesh_lod];
+    lines[0] << std::fixed << std::setprecision(3) << "lod " << mesh_lod << " of " << mesh_levels.size()
+        << ", triangles " << level.bvh.visibleTriangles << " of " << level.triangleCount
+        << " visible, cull ms " << level.bvh.cullMs;
+    lines[1] << std::fixed << std::setprecision(2) << "cpu ms p50 " << percentile(frame_stats.cpu, 50)
+        << " p95 " << percentile(frame_stats.cpu, 95) << " p99 " << percentile(frame_stats.cpu, 99);
+    if (frame_stats.timed)
+        lines[2] << std::fixed << std::setprecision(2) << "gpu ms p50 " << percentile(frame_stats.gpu, 50)
+            << " p95 " << percentile(frame_stats.gpu, 95) << " p99 " << percentile(frame_stats.gpu, 99);
+    else
+        lines[2] << "gpu ms n/a, no timer queries";
+
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, window_width, 0, window_height);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+
+    glColor3f(1.0f, 1.0f, 0.0f);
+    for (int i = 0; i < 3; i++)
+    {
+        glRasterPos2i(10, window_height - 20 - 16 * i);
+        for (char c : lines[i].str())
+            glutBitmapCharacter(GLUT_BITMAP_8_BY_13, c);
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
 void reshape(int w, int h) {
+    window_width = w;
+    window_height = h;
     glViewport(0, 0, w, h);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -138,8 +928,9 @@ void arrow_keys(int key, int x, int y) {
         camera.theta += ROTATE_SPEED;
         break;
     default:
-        break;
+        return;
     }
+    glutPostRedisplay();
 }
 
 void keyboard(unsigned char key, int x, int y) {
@@ -152,12 +943,19 @@ void keyboard(unsigned char key, int x, int y) {
     case 'w':
         render_mode = false;
         break;
-    default:
+    case 'h':
+        frame_stats.shown = !frame_stats.shown;
+        frame_stats.cpu.clear();
+        frame_stats.gpu.clear();
         break;
+    default:
+        return;
     }
+    glutPostRedisplay();
 }
 
 void display() {
+    auto start = std::chrono::steady_clock::now();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glLoadIdentity();
 
@@ -166,24 +964,247 @@ void display() {
     camera.z = DISTANCE * cos(camera.theta);
 
     gluLookAt(camera.x, camera.y, camera.z, 0, 2.0f, 0, 0.0f, 1.0f, 0.0f);
-    draw_obj(triangles_array, verticles_array, triangles_number, verticles_number);
+    mesh_lod = select_lod();
+    begin_frame_query();
+    draw_mesh(mesh_levels[mesh_lod]);
+    end_frame_query();
+
+    // Only the HUD redraws on its own, everything else asks
+    // for a redraw when it changes what is shown
+    if (frame_stats.shown)
+    {
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        push_frame_time(frame_stats.cpu, ms.count());
+        draw_hud();
+        glutPostRedisplay();
+    }
     glutSwapBuffers();
-    glutPostRedisplay();
 }
 
 ///
-//  Create an OpenCL context on the first available platform using
-//  either a GPU or CPU depending on what is available.
+//  A command or host phase timed with --profile. Commands
+//  keep their event, host phases their start and end in
+//  seconds since the program started
 //
-cl_context CreateContext()
+struct profile_entry
 {
-    cl_int errNum;
-    cl_uint numPlatforms;
-    cl_platform_id firstPlatformId;
-    cl_context context = NULL;
+    std::string name;
+    bool command;
+    cl_event event;
+    double start, end;
+};
 
-    // First, select an OpenCL platform to run on.  For this example, we
-    // simply choose the first available platform.  Normally, you would
+bool profiling = false;
+std::deque<profile_entry> profile_entries;
+const std::chrono::steady_clock::time_point profile_origin = std::chrono::steady_clock::now();
+
+///
+//  Seconds since the program started
+//
+double profile_clock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - profile_origin).count();
+}
+
+///
+//  Properties of every command queue, the devices only
+//  record the times of commands with --profile
+//
+cl_command_queue_properties queue_properties()
+{
+    return profiling ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+///
+//  Where a command nothing else waits on puts its event,
+//  NULL when not profiling
+//
+cl_event* profile_event(const std::string& name)
+{
+    if (!profiling)
+        return NULL;
+    profile_entries.push_back(profile_entry{ name, true, NULL, 0.0, 0.0 });
+    return &profile_entries.back().event;
+}
+
+///
+//  Time a command whose event the caller also waits on
+//  and releases
+//
+void profile_command(const std::string& name, cl_event event)
+{
+    if (!profiling || event == NULL)
+        return;
+    clRetainEvent(event);
+    profile_entries.push_back(profile_entry{ name, true, event, 0.0, 0.0 });
+}
+
+///
+//  Time a host phase that began at start
+//
+void profile_host(const std::string& name, double start)
+{
+    if (profiling)
+        profile_entries.push_back(profile_entry{ name, false, NULL, start, profile_clock() });
+}
+
+///
+//  Escape a name for a JSON string
+//
+std::string json_string(const std::string& text)
+{
+    std::string escaped = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += (unsigned char)c < 0x20 ? ' ' : c;
+    }
+    return escaped + "\"";
+}
+
+///
+//  Print the timed host phases and commands, and write each
+//  of them to PROFILE_FILE
+//
+//  Entries of the same name are summed in the printout. A
+//  command runs from its start to its end and waits from
+//  being queued to its start. Commands are named after
+//  what they do first, upload, kernel or readback, and the
+//  largest of the three totals bounds the run
+//
+void profile_report()
+{
+    if (!profiling)
+        return;
+
+    struct summary { std::string name; bool command; size_t count; double run, wait; };
+    std::vector<summary> summaries;
+    const char* categories[3] = { "upload", "kernel", "readback" };
+    double totals[3] = { 0.0, 0.0, 0.0 };
+    cl_ulong origin = 0;
+    bool first = true;
+
+    std::vector<cl_ulong> times(4 * profile_entries.size(), 0);
+    for (size_t i = 0; i < profile_entries.size(); i++)
+    {
+        const profile_entry& entry = profile_entries[i];
+        if (!entry.command || entry.event == NULL)
+            continue;
+        const cl_profiling_info info[4] = { CL_PROFILING_COMMAND_QUEUED,
+            CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END };
+        for (int j = 0; j < 4; j++)
+            clGetEventProfilingInfo(entry.event, info[j], sizeof(cl_ulong), &times[4 * i + j], NULL);
+        if (first || times[4 * i] < origin)
+            origin = times[4 * i];
+        first = false;
+    }
+
+    std::ofstream json(PROFILE_FILE);
+    json << "{\n  \"host\": [";
+    const char* separator = "\n";
+    for (const profile_entry& entry : profile_entries)
+    {
+        if (entry.command)
+            continue;
+        json << separator << "    { \"name\": " << json_string(entry.name)
+            << ", \"start_ms\": " << entry.start * 1e3 << ", \"end_ms\": " << entry.end * 1e3 << " }";
+        separator = ",\n";
+    }
+    json << "\n  ],\n  \"commands\": [";
+    separator = "\n";
+
+    for (size_t i = 0; i < profile_entries.size(); i++)
+    {
+        const profile_entry& entry = profile_entries[i];
+        if (entry.command && entry.event == NULL)
+            continue;
+
+        double run, wait = 0.0;
+        if (entry.command)
+        {
+            const cl_ulong* t = &times[4 * i];
+            run = (t[3] - t[2]) * 1e-6;
+            wait = (t[2] - t[0]) * 1e-6;
+            json << separator << "    { \"name\": " << json_string(entry.name)
+                << ", \"queued_ns\": " << t[0] - origin << ", \"submit_ns\": " << t[1] - origin
+                << ", \"start_ns\": " << t[2] - origin << ", \"end_ns\": " << t[3] - origin << " }";
+            separator = ",\n";
+
+            for (int j = 0; j < 3; j++)
+            {
+                if (entry.name.compare(0, strlen(categories[j]), categories[j]) == 0)
+                    totals[j] += run;
+            }
+        }
+        else
+            run = (entry.end - entry.start) * 1e3;
+
+        size_t k = 0;
+        while (k < summaries.size()
+            && (summaries[k].name != entry.name || summaries[k].command != entry.command))
+            k++;
+        if (k == summaries.size())
+            summaries.push_back(summary{ entry.name, entry.command, 0, 0.0, 0.0 });
+        summaries[k].count++;
+        summaries[k].run += run;
+        summaries[k].wait += wait;
+    }
+
+    int bound = 0;
+    for (int j = 1; j < 3; j++)
+    {
+        if (totals[j] > totals[bound])
+            bound = j;
+    }
+    json << "\n  ],\n  \"totals_ms\": { ";
+    for (int j = 0; j < 3; j++)
+        json << "\"" << categories[j] << "\": " << totals[j] << ", ";
+    json << "\"bound\": \"" << categories[bound] << "\" }\n}\n";
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << std::left << std::setw(32) << "Host phase" << std::right
+        << std::setw(8) << "count" << std::setw(12) << "ms" << std::endl;
+    for (const summary& s : summaries)
+    {
+        if (!s.command)
+            std::cout << std::left << std::setw(32) << s.name << std::right
+                << std::setw(8) << s.count << std::setw(12) << s.run << std::endl;
+    }
+    std::cout << std::left << std::setw(32) << "Device command" << std::right
+        << std::setw(8) << "count" << std::setw(12) << "run ms" << std::setw(12) << "wait ms" << std::endl;
+    for (const summary& s : summaries)
+    {
+        if (s.command)
+            std::cout << std::left << std::setw(32) << s.name << std::right << std::setw(8) << s.count
+                << std::setw(12) << s.run << std::setw(12) << s.wait << std::endl;
+    }
+    std::cout << "Upload " << totals[0] << " ms, kernel " << totals[1] << " ms, readback "
+        << totals[2] << " ms, bound by " << categories[bound] << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << "Profile written to " << PROFILE_FILE << std::endl;
+
+    for (const profile_entry& entry : profile_entries)
+    {
+        if (entry.event != NULL)
+            clReleaseEvent(entry.event);
+    }
+    profile_entries.clear();
+}
+
+///
+//  Create an OpenCL context on the first available platform using
+//  either a GPU or CPU depending on what is available.
+//
+cl_context CreateContext()
+{
+    cl_int errNum;
+    cl_uint numPlatforms;
+    cl_platform_id firstPlatformId;
+    cl_context context = NULL;
+
+    // First, select an OpenCL platform to run on.  For this example, we
+    // simply choose the first available platform.  Normally, you would
     // query for all available platforms and select the most appropriate one.
     errNum = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
     if (errNum != CL_SUCCESS || numPlatforms <= 0)
@@ -215,158 +1236,1928 @@ cl_context CreateContext()
         }
     }
 
-    return context;
+    return context;
+}
+
+///
+//  Create a command queue on the first device available on the
+//  context
+//
+cl_command_queue CreateCommandQueue(cl_context context, cl_device_id *device)
+{
+    cl_int errNum;
+    cl_device_id *devices;
+    cl_command_queue commandQueue = NULL;
+    size_t deviceBufferSize = -1;
+
+    // First get the size of the devices buffer
+    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &deviceBufferSize);
+    if (errNum != CL_SUCCESS)
+    {
+        std::cerr << "Failed call to clGetContextInfo(...,GL_CONTEXT_DEVICES,...)";
+        return NULL;
+    }
+
+    if (deviceBufferSize <= 0)
+    {
+        std::cerr << "No devices available.";
+        return NULL;
+    }
+
+    // Allocate memory for the devices buffer
+    devices = new cl_device_id[deviceBufferSize / sizeof(cl_device_id)];
+    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, deviceBufferSize, devices, NULL);
+    if (errNum != CL_SUCCESS)
+    {
+        delete [] devices;
+        std::cerr << "Failed to get device IDs";
+        return NULL;
+    }
+
+    // In this example, we just choose the first available device.  In a
+    // real program, you would likely use all available devices or choose
+    // the highest performance device based on OpenCL device queries
+    commandQueue = clCreateCommandQueue(context, devices[0], queue_properties(), NULL);
+    if (commandQueue == NULL)
+    {
+        delete [] devices;
+        std::cerr << "Failed to create commandQueue for device 0";
+        return NULL;
+    }
+
+    *device = devices[0];
+    delete [] devices;
+    return commandQueue;
+}
+
+///
+//  Get a string property of a device, empty on failure
+//
+std::string device_string(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    if (clGetDeviceInfo(device, param, 0, NULL, &size) != CL_SUCCESS || size == 0)
+        return "";
+
+    std::string value(size, '\0');
+    if (clGetDeviceInfo(device, param, size, &value[0], NULL) != CL_SUCCESS)
+        return "";
+    value.resize(strlen(value.c_str()));
+    return value;
+}
+
+///
+//  FNV-1a hash of a string
+//
+cl_ulong fnv1a(const std::string& data)
+{
+    cl_ulong hash = 14695981039346656037ULL;
+    for (unsigned char c : data)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+///
+//  Key of a cached program binary: the platform, device and
+//  driver it was built for, its build options and the hash
+//  of its source
+//
+std::string program_cache_key(cl_device_id device, const std::string& source, const char* options)
+{
+    cl_platform_id platform = NULL;
+    char platformName[1024] = "", platformVersion[1024] = "";
+    clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+    clGetPlatformInfo(platform, CL_PLATFORM_NAME, sizeof(platformName), platformName, NULL);
+    clGetPlatformInfo(platform, CL_PLATFORM_VERSION, sizeof(platformVersion), platformVersion, NULL);
+
+    std::ostringstream key;
+    key << platformName << '\n' << platformVersion << '\n'
+        << device_string(device, CL_DEVICE_NAME) << '\n'
+        << device_string(device, CL_DRIVER_VERSION) << '\n'
+        << options << '\n' << std::hex << fnv1a(source);
+    return key.str();
+}
+
+///
+//  Create a program from a cached binary stored with the
+//  given key, NULL when there is none or it is stale
+//
+cl_program load_program_binary(cl_context context, cl_device_id device,
+    const std::string& path, const std::string& key)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return NULL;
+
+    // The key is stored in front of the binary
+    std::string storedKey;
+    std::getline(file, storedKey, '\0');
+    if (!file || storedKey != key)
+        return NULL;
+
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    if (binary.empty())
+        return NULL;
+
+    const unsigned char* binaries[1] = { binary.data() };
+    size_t sizes[1] = { binary.size() };
+    cl_int binaryStatus = CL_SUCCESS, errNum = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, sizes, binaries,
+        &binaryStatus, &errNum);
+    if (program == NULL || errNum != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        if (program != NULL)
+            clReleaseProgram(program);
+        return NULL;
+    }
+
+    // A binary still has to be built, one the driver
+    // no longer accepts fails here
+    if (clBuildProgram(program, 1, &device, BUILD_OPTIONS, NULL, NULL) != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+///
+//  Store the binary a program was built into for a device
+//  with the given key
+//
+//  The binary is written next to the final name, under a
+//  name of its own for each process, and renamed over it, so
+//  concurrent processes never read half of it and a binary
+//  the driver rejected is replaced
+//
+bool save_program_binary(cl_program program, cl_device_id device,
+    const std::string& path, const std::string& key)
+{
+    cl_uint deviceCount = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &deviceCount, NULL) != CL_SUCCESS
+        || deviceCount == 0)
+        return false;
+
+    std::vector<cl_device_id> devices(deviceCount);
+    std::vector<size_t> sizes(deviceCount);
+    if (clGetProgramInfo(program, CL_PROGRAM_DEVICES, sizeof(cl_device_id) * deviceCount,
+            devices.data(), NULL) != CL_SUCCESS
+        || clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * deviceCount,
+            sizes.data(), NULL) != CL_SUCCESS)
+        return false;
+
+    // Only the binary of this device is copied out
+    std::vector<unsigned char*> binaries(deviceCount, (unsigned char*)NULL);
+    std::vector<unsigned char> binary;
+    for (cl_uint i = 0; i < deviceCount; i++)
+    {
+        if (devices[i] == device && sizes[i] > 0)
+        {
+            binary.resize(sizes[i]);
+            binaries[i] = binary.data();
+        }
+    }
+    if (binary.empty()
+        || clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*) * deviceCount,
+            binaries.data(), NULL) != CL_SUCCESS)
+        return false;
+
+    std::string writePath = path + "." + std::to_string(objl::ProcessId()) + ".tmp";
+    std::ofstream file(writePath, std::ios::binary | std::ios::trunc);
+    file.write(key.c_str(), key.size() + 1);
+    file.write((const char*)binary.data(), binary.size());
+    file.close();
+
+#ifdef _WIN32
+    if (!file || !MoveFileExA(writePath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+    if (!file || std::rename(writePath.c_str(), path.c_str()) != 0)
+#endif
+    {
+        std::remove(writePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+///
+//  Create an OpenCL program from the kernel source file, or
+//  from the binary cached by an earlier build of the same
+//  source for the same platform, device, driver and build
+//  options
+//
+cl_program CreateProgram(cl_context context, cl_device_id device, const char* fileName)
+{
+    cl_int errNum;
+    cl_program program;
+
+    std::ifstream kernelFile(fileName, std::ios::in);
+    if (!kernelFile.is_open())
+    {
+        std::cerr << "Failed to open file for reading: " << fileName << std::endl;
+        return NULL;
+    }
+
+    std::ostringstream oss;
+    oss << kernelFile.rdbuf();
+
+    std::string srcStdStr = oss.str();
+
+    // Skip the build when it is cached
+    std::string key = program_cache_key(device, srcStdStr, BUILD_OPTIONS);
+    std::ostringstream binaryPath;
+    binaryPath << fileName << "." << std::hex << fnv1a(key) << ".bin";
+    program = load_program_binary(context, device, binaryPath.str(), key);
+    if (program != NULL)
+        return program;
+
+    const char *srcStr = srcStdStr.c_str();
+    program = clCreateProgramWithSource(context, 1,
+                                        (const char**)&srcStr,
+                                        NULL, NULL);
+    if (program == NULL)
+    {
+        std::cerr << "Failed to create CL program from source." << std::endl;
+        return NULL;
+    }
+
+    errNum = clBuildProgram(program, 0, NULL, BUILD_OPTIONS, NULL, NULL);
+    if (errNum != CL_SUCCESS)
+    {
+        // Determine the reason for the error
+        char buildLog[16384];
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG,
+                              sizeof(buildLog), buildLog, NULL);
+
+        std::cerr << "Error in kernel: " << std::endl;
+        std::cerr << buildLog;
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    save_program_binary(program, device, binaryPath.str(), key);
+
+    return program;
+}
+
+///
+//  Parse the criteria of --filter, a comma separated list of
+//  name[=value] for small=min edge, degenerate=max area,
+//  sliver=max aspect ratio, long=max edge and normal=max
+//  angle in degrees to the smooth normal
+//
+bool parse_filter(const char* spec, filter_params& params)
+{
+    std::stringstream list(spec);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        size_t equals = item.find('=');
+        std::string name = item.substr(0, equals);
+        bool hasValue = equals != std::string::npos;
+        float value = 0.0f;
+        if (hasValue)
+        {
+            const char* text = item.c_str() + equals + 1;
+            char* end = NULL;
+            value = strtof(text, &end);
+            if (*text == '\0' || *end != '\0' || !std::isfinite(value) || value < 0.0f)
+            {
+                std::cerr << "Bad filter value: " << item << std::endl;
+                return false;
+            }
+        }
+
+        int reason = 0;
+        while (reason < FILTER_REASONS && name != FILTER_NAMES[reason])
+            reason++;
+        if (reason == FILTER_REASONS)
+        {
+            std::cerr << "Unknown filter criterion: " << name << std::endl;
+            return false;
+        }
+
+        params.criteria |= 1u << reason;
+        if (!hasValue)
+            continue;
+        switch (1 << reason)
+        {
+        case FILTER_SMALL:
+            params.min_edge = value;
+            break;
+        case FILTER_DEGENERATE:
+            params.min_area = value;
+            break;
+        case FILTER_SLIVER:
+            params.max_aspect = value;
+            break;
+        case FILTER_LONG:
+            params.max_edge = value;
+            break;
+        case FILTER_NORMAL:
+            params.min_normal_cos = (cl_float)cos(value * 3.14159265358979 / 180.0);
+            break;
+        }
+    }
+    return true;
+}
+
+///
+//  Compute face_normals and smooth_normals of the loaded
+//  mesh on the CPU, unless they already are
+//
+void compute_normals()
+{
+    if (face_normals.size() == triangles_number && smooth_normals.size() == verticles_number)
+        return;
+
+    double start = profile_clock();
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    face_normals.resize(triangles_number);
+    smooth_normals.resize(verticles_number);
+    cpu_face_normals((float*)face_normals.data(), (const uint32_t*)triangles_array, triangles_number,
+        (const float*)verticles_array, threads);
+
+    std::vector<uint32_t> offsets, adjacent;
+    cpu_vertex_triangles(offsets, adjacent, (const uint32_t*)triangles_array, triangles_number,
+        verticles_number);
+    cpu_vertex_normals((float*)smooth_normals.data(), (const float*)face_normals.data(),
+        offsets, adjacent, verticles_number, threads);
+    profile_host("normals", start);
+}
+
+///
+//  Create the vertex normals and reason counts of
+//  filter_triangles and set them as its last arguments.
+//  The normals are only computed when the normal criterion
+//  is enabled
+//
+bool create_filter_objects(cl_context context, cl_kernel kernel,
+    cl_mem mem_objects[MEM_OBJECTS], const filter_params& params)
+{
+    std::vector<cl_float3> none(1);
+    if (params.criteria & FILTER_NORMAL)
+        compute_normals();
+    const std::vector<cl_float3>& normals = (params.criteria & FILTER_NORMAL) && !smooth_normals.empty()
+        ? smooth_normals : none;
+    cl_uint counts[FILTER_REASONS] = { 0 };
+
+    mem_objects[3] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_float3) * normals.size(), (void*)normals.data(), NULL);
+    mem_objects[4] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        sizeof(counts), counts, NULL);
+    if (mem_objects[3] == NULL || mem_objects[4] == NULL)
+    {
+        std::cerr << "Error creating memory objects" << std::endl;
+        return false;
+    }
+
+    cl_int errNum = clSetKernelArg(kernel, 4, sizeof(cl_mem), &mem_objects[3]);
+    errNum |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem_objects[4]);
+    if (errNum != CL_SUCCESS)
+    {
+        std::cerr << "Error setting kernel arguments." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///
+//  Clear the first count counts of filter_triangles or
+//  sweep_thresholds, after the runs that tuned it
+//
+bool reset_counts(cl_command_queue commandQueue, cl_mem mem_objects[MEM_OBJECTS], size_t count)
+{
+    std::vector<cl_uint> counts(count, 0);
+    return clEnqueueWriteBuffer(commandQueue, mem_objects[4], CL_TRUE,
+        0, sizeof(cl_uint) * count, counts.data(), 0, NULL, profile_event("upload counts")) == CL_SUCCESS;
+}
+
+///
+//  Print how many triangles filter_triangles flagged for
+//  each enabled criterion
+//
+bool report_filter(cl_command_queue commandQueue, cl_mem mem_objects[MEM_OBJECTS],
+    const filter_params& params)
+{
+    cl_uint counts[FILTER_REASONS];
+    if (clEnqueueReadBuffer(commandQueue, mem_objects[4], CL_TRUE,
+            0, sizeof(counts), counts, 0, NULL, profile_event("readback filter counts")) != CL_SUCCESS)
+    {
+        std::cerr << "Error reading filter counts." << std::endl;
+        return false;
+    }
+
+    for (int i = 0; i < FILTER_REASONS; i++)
+    {
+        if (params.criteria & (1u << i))
+            std::cout << "Filter " << FILTER_NAMES[i] << ": " << counts[i]
+                << " of " << triangles_number << " triangles" << std::endl;
+    }
+    return true;
+}
+
+///
+//  Parse the thresholds of --sweep, such as
+//  "0.01,0.02,0.05", into ascending order without repeats
+//
+bool parse_sweep(const char* spec, std::vector<cl_float>& thresholds)
+{
+    std::stringstream list(spec);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        char* end = NULL;
+        float value = strtof(item.c_str(), &end);
+        if (item.empty() || *end != '\0')
+        {
+            std::cerr << "Bad sweep threshold: " << item << std::endl;
+            return false;
+        }
+        thresholds.push_back(value);
+    }
+
+    std::sort(thresholds.begin(), thresholds.end());
+    thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+    if (thresholds.empty() || thresholds.size() > SWEEP_MAX)
+    {
+        std::cerr << "A sweep takes 1 to " << SWEEP_MAX << " thresholds." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///
+//  Create the counts per threshold of sweep_thresholds and
+//  set its arguments after the four of set_is_small
+//
+bool create_sweep_objects(cl_context context, cl_kernel kernel,
+    cl_mem mem_objects[MEM_OBJECTS], const std::vector<cl_float>& thresholds)
+{
+    std::vector<cl_uint> counts(thresholds.size(), 0);
+    mem_objects[4] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_uint) * counts.size(), counts.data(), NULL);
+    if (mem_objects[4] == NULL)
+    {
+        std::cerr << "Error creating memory objects" << std::endl;
+        return false;
+    }
+
+    cl_uint thresholdCount = (cl_uint)thresholds.size();
+    cl_int errNum = clSetKernelArg(kernel, 4, sizeof(cl_uint), &thresholdCount);
+    errNum |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &mem_objects[4]);
+    if (errNum != CL_SUCCESS)
+    {
+        std::cerr << "Error setting kernel arguments." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///
+//  Print how many triangles each threshold of the sweep
+//  flags, and how many of them it is the first to flag
+//
+bool report_sweep(cl_command_queue commandQueue, cl_mem mem_objects[MEM_OBJECTS],
+    const std::vector<cl_float>& thresholds)
+{
+    std::vector<cl_uint> counts(thresholds.size());
+    if (clEnqueueReadBuffer(commandQueue, mem_objects[4], CL_TRUE,
+            0, sizeof(cl_uint) * counts.size(), counts.data(), 0, NULL,
+            profile_event("readback sweep counts")) != CL_SUCCESS)
+    {
+        std::cerr << "Error reading sweep counts." << std::endl;
+        return false;
+    }
+
+    // A triangle flagged at a threshold is flagged at every
+    // larger one too
+    size_t flagged = 0;
+    for (size_t i = 0; i < thresholds.size(); i++)
+    {
+        flagged += counts[i];
+        std::cout << "Threshold " << thresholds[i] << ": " << flagged << " of "
+            << triangles_number << " triangles, " << counts[i] << " first flagged here" << std::endl;
+    }
+    return true;
+}
+
+///
+//  Whether a device can use host arrays in place: it shares
+//  memory with the host and the arrays are aligned as it
+//  needs
+//
+bool is_zero_copy(cl_device_id device, const void* triangles, const void* vertices)
+{
+    cl_bool unified = CL_FALSE;
+    cl_uint alignBits = 0;
+    if (clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL) != CL_SUCCESS
+        || clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &alignBits, NULL) != CL_SUCCESS
+        || unified != CL_TRUE)
+        return false;
+
+    size_t align = alignBits / 8 != 0 ? alignBits / 8 : 1;
+    return (size_t)triangles % align == 0 && (size_t)vertices % align == 0;
+}
+
+///
+//  Create memory objects used as the arguments to the kernel
+//  The kernel takes four arguments: triangles_array - input and output;
+//  verticles_array, triangles_size, verticles_size, min or the
+//  filter_params - input;
+//
+//  With zeroCopy the buffers use the host arrays in place,
+//  otherwise they are left empty for classify_pipelined to
+//  fill
+//
+bool create_mem_objects(cl_context context, cl_mem mem_objects[MEM_OBJECTS],
+    cl_uint4* triangles_array, cl_float3* verticles_array,
+    size_t *triangles_size, size_t *verticles_size,
+    const void *params, size_t paramsSize, bool zeroCopy)
+{
+    cl_mem_flags hostFlags = zeroCopy ? CL_MEM_USE_HOST_PTR : 0;
+    mem_objects[0] = clCreateBuffer(context, CL_MEM_READ_WRITE | hostFlags,
+        sizeof(cl_uint4) * (*triangles_size), zeroCopy ? triangles_array : NULL, NULL);
+    mem_objects[1] = clCreateBuffer(context, CL_MEM_READ_ONLY | hostFlags,
+        sizeof(cl_float3) * (*verticles_size), zeroCopy ? verticles_array : NULL, NULL);
+    mem_objects[2] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        paramsSize, (void*)params, NULL);
+
+    bool check = true;
+    for (int i = 0; i < 3; i++)
+        if (mem_objects[i] == NULL)
+            check = false;
+    if (!check)
+    {
+        std::cerr << "Error creating memory objects" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///
+//  Enqueue a kernel over count work-items from offset with
+//  the given local work size, or the runtime's choice for
+//  0. The global size is padded to a multiple of the local
+//  size, the kernel skips the padding work-items
+//
+cl_int enqueue_padded(cl_command_queue commandQueue, cl_kernel kernel,
+    size_t count, size_t localSize, size_t offset = 0,
+    cl_uint numEvents = 0, const cl_event* waitList = NULL, cl_event* event = NULL)
+{
+    size_t step = localSize != 0 ? localSize : 1;
+    size_t globalWorkOffset[1] = { offset };
+    size_t globalWorkSize[1] = { (count + step - 1) / step * step };
+    size_t localWorkSize[1] = { localSize };
+
+    return clEnqueueNDRangeKernel(commandQueue, kernel, 1, offset != 0 ? globalWorkOffset : NULL,
+        globalWorkSize, localSize != 0 ? localWorkSize : NULL,
+        numEvents, waitList, event);
+}
+
+///
+//  Compute face_normals and smooth_normals with the
+//  face_normals and vertex_normals kernels. The host only
+//  lists the triangles around each vertex
+//
+bool compute_normals_device(cl_context context, cl_command_queue commandQueue, cl_program program)
+{
+    if (triangles_number == 0)
+    {
+        compute_normals();
+        return true;
+    }
+
+    double start = profile_clock();
+    std::vector<uint32_t> offsets, adjacent;
+    cpu_vertex_triangles(offsets, adjacent, (const uint32_t*)triangles_array, triangles_number,
+        verticles_number);
+
+    cl_kernel kernels[2] = { clCreateKernel(program, "face_normals", NULL),
+        clCreateKernel(program, "vertex_normals", NULL) };
+    cl_mem buffers[6] = {
+        clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(cl_uint4) * triangles_number, triangles_array, NULL),
+        clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(cl_float3) * verticles_number, verticles_array, NULL),
+        clCreateBuffer(context, CL_MEM_READ_WRITE,
+            sizeof(cl_float3) * triangles_number, NULL, NULL),
+        clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(cl_uint) * offsets.size(), offsets.data(), NULL),
+        clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            sizeof(cl_uint) * adjacent.size(), adjacent.data(), NULL),
+        clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+            sizeof(cl_float3) * verticles_number, NULL, NULL) };
+
+    bool check = kernels[0] != NULL && kernels[1] != NULL;
+    for (cl_mem buffer : buffers)
+        check = check && buffer != NULL;
+
+    if (check)
+    {
+        cl_uint triangles_size = (cl_uint)triangles_number, vertices_size = (cl_uint)verticles_number;
+        cl_int errNum = clSetKernelArg(kernels[0], 0, sizeof(cl_mem), &buffers[0]);
+        errNum |= clSetKernelArg(kernels[0], 1, sizeof(cl_mem), &buffers[1]);
+        errNum |= clSetKernelArg(kernels[0], 2, sizeof(cl_mem), &buffers[2]);
+        errNum |= clSetKernelArg(kernels[0], 3, sizeof(cl_uint), &triangles_size);
+        errNum |= clSetKernelArg(kernels[1], 0, sizeof(cl_mem), &buffers[3]);
+        errNum |= clSetKernelArg(kernels[1], 1, sizeof(cl_mem), &buffers[4]);
+        errNum |= clSetKernelArg(kernels[1], 2, sizeof(cl_mem), &buffers[2]);
+        errNum |= clSetKernelArg(kernels[1], 3, sizeof(cl_mem), &buffers[5]);
+        errNum |= clSetKernelArg(kernels[1], 4, sizeof(cl_uint), &vertices_size);
+
+        errNum |= enqueue_padded(commandQueue, kernels[0], triangles_number, 0,
+            0, 0, NULL, profile_event("kernel face_normals"));
+        errNum |= enqueue_padded(commandQueue, kernels[1], verticles_number, 0,
+            0, 0, NULL, profile_event("kernel vertex_normals"));
+
+        face_normals.resize(triangles_number);
+        smooth_normals.resize(verticles_number);
+        errNum |= clEnqueueReadBuffer(commandQueue, buffers[2], CL_TRUE,
+            0, sizeof(cl_float3) * triangles_number, face_normals.data(), 0, NULL,
+            profile_event("readback face normals"));
+        errNum |= clEnqueueReadBuffer(commandQueue, buffers[5], CL_TRUE,
+            0, sizeof(cl_float3) * verticles_number, smooth_normals.data(), 0, NULL,
+            profile_event("readback vertex normals"));
+        check = errNum == CL_SUCCESS;
+    }
+
+    for (cl_kernel kernel : kernels)
+    {
+        if (kernel != NULL)
+            clReleaseKernel(kernel);
+    }
+    for (cl_mem buffer : buffers)
+    {
+        if (buffer != NULL)
+            clReleaseMemObject(buffer);
+    }
+
+    if (!check)
+    {
+        std::cerr << "Error computing normals on the device." << std::endl;
+        face_normals.clear();
+        smooth_normals.clear();
+        return false;
+    }
+    profile_host("normals device", start);
+    return true;
+}
+
+///
+//  Key of a kernel's tuned local work size in TUNING_FILE
+//
+std::string tuning_key(cl_device_id device, cl_kernel kernel)
+{
+    char kernelName[256] = "";
+    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(kernelName), kernelName, NULL);
+    return device_string(device, CL_DEVICE_VENDOR) + " | "
+        + device_string(device, CL_DEVICE_NAME) + " | "
+        + device_string(device, CL_DRIVER_VERSION) + " | " + kernelName;
+}
+
+///
+//  Look up the local work size tune_local_size stored for a
+//  kernel on a device
+//
+bool stored_local_size(cl_device_id device, cl_kernel kernel, size_t* localSize)
+{
+    std::string key = tuning_key(device, kernel);
+    std::ifstream stored(TUNING_FILE);
+    std::string line;
+    while (std::getline(stored, line))
+    {
+        size_t tab = line.rfind('\t');
+        if (tab != std::string::npos && line.compare(0, tab, key) == 0 && tab == key.size())
+        {
+            *localSize = strtoul(line.c_str() + tab + 1, NULL, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
+///
+//  Find the fastest local work size of a kernel for count
+//  work-items, with the kernel arguments already set
+//
+//  The candidates are the runtime's own choice and the
+//  preferred work-group size multiple times powers of two
+//  up to CL_KERNEL_WORK_GROUP_SIZE, each timed on the real
+//  arguments, so the kernel must give the same result when
+//  run again. The choice is stored in TUNING_FILE for the
+//  device, driver and kernel, later runs reuse it
+//
+size_t tune_local_size(cl_command_queue commandQueue, cl_device_id device,
+    cl_kernel kernel, size_t count)
+{
+    // Reuse a stored choice
+    size_t stored = 0;
+    if (stored_local_size(device, kernel, &stored))
+        return stored;
+
+    char kernelName[256] = "";
+    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(kernelName), kernelName, NULL);
+
+    size_t maxSize = 1, multiple = 1;
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(size_t), &maxSize, NULL);
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+        sizeof(size_t), &multiple, NULL);
+    if (maxSize == 0)
+        maxSize = 1;
+    if (multiple == 0 || multiple > maxSize)
+        multiple = 1;
+
+    std::vector<size_t> candidates(1, 0);
+    for (size_t size = multiple; size <= maxSize; size *= 2)
+        candidates.push_back(size);
+    if (candidates.back() != maxSize)
+        candidates.push_back(maxSize);
+
+    // Best of three runs after a warm-up run
+    size_t best = 0;
+    double bestSeconds = -1.0;
+    for (size_t candidate : candidates)
+    {
+        double fastest = -1.0;
+        for (int run = 0; run < 4; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (enqueue_padded(commandQueue, kernel, count, candidate) != CL_SUCCESS
+                || clFinish(commandQueue) != CL_SUCCESS)
+            {
+                fastest = -1.0;
+                break;
+            }
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            if (run > 0 && (fastest < 0.0 || seconds.count() < fastest))
+                fastest = seconds.count();
+        }
+        if (fastest >= 0.0 && (bestSeconds < 0.0 || fastest < bestSeconds))
+        {
+            best = candidate;
+            bestSeconds = fastest;
+        }
+    }
+
+    std::ofstream tuning(TUNING_FILE, std::ios::app);
+    tuning << tuning_key(device, kernel) << '\t' << best << '\n';
+
+    std::cout << "Tuned " << kernelName << " local work size: ";
+    if (best != 0)
+        std::cout << best << std::endl;
+    else
+        std::cout << "runtime choice" << std::endl;
+    return best;
+}
+
+///
+//  Classify the triangles of a file batch by batch with
+//  set_is_small, so host and device memory stay bounded
+//  by the batch size however large the file is
+//
+bool classify_stream(cl_context context, cl_command_queue commandQueue, cl_device_id device,
+    cl_kernel kernel, cl_mem mem_objects[MEM_OBJECTS], const char* fileName, cl_float min)
+{
+    cl_int errNum;
+
+    mem_objects[2] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_float), &min, NULL);
+    if (mem_objects[2] == NULL)
+    {
+        std::cerr << "Error creating memory objects" << std::endl;
+        return false;
+    }
+
+    // Device buffers sized for the largest batch seen so far,
+    // a batch uses at most three vertices per triangle
+    size_t triangleCapacity = 0, vertexCapacity = 0;
+    std::vector<cl_uint4> triangles;
+    std::vector<cl_float3> vertices;
+    size_t total = 0, flagged = 0;
+    bool tuned = false;
+    size_t localSize = 0;
+
+    objl::Loader Loader;
+    bool streamed = Loader.StreamFile(fileName, STREAM_BATCH, [&](const objl::TriangleBatch& batch)
+    {
+        size_t count = batch.Indices.size() / 3;
+
+        if (count > triangleCapacity || batch.Positions.size() > vertexCapacity)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                if (mem_objects[i] != 0)
+                    clReleaseMemObject(mem_objects[i]);
+            }
+            triangleCapacity = std::max(count, STREAM_BATCH);
+            vertexCapacity = std::max(batch.Positions.size(), STREAM_BATCH * 3);
+            mem_objects[0] = clCreateBuffer(context, CL_MEM_READ_WRITE,
+                sizeof(cl_uint4) * triangleCapacity, NULL, NULL);
+            mem_objects[1] = clCreateBuffer(context, CL_MEM_READ_ONLY,
+                sizeof(cl_float3) * vertexCapacity, NULL, NULL);
+            if (mem_objects[0] == NULL || mem_objects[1] == NULL)
+            {
+                std::cerr << "Error creating memory objects" << std::endl;
+                return false;
+            }
+        }
+
+        triangles.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            triangles[i].x = batch.Indices[i * 3];
+            triangles[i].y = batch.Indices[i * 3 + 1];
+            triangles[i].z = batch.Indices[i * 3 + 2];
+            triangles[i].w = 0;
+        }
+        vertices.resize(batch.Positions.size());
+        for (size_t i = 0; i < batch.Positions.size(); i++)
+        {
+            vertices[i].x = batch.Positions[i].X;
+            vertices[i].y = batch.Positions[i].Y;
+            vertices[i].z = batch.Positions[i].Z;
+            vertices[i].w = 0.0f;
+        }
+
+        errNum = clEnqueueWriteBuffer(commandQueue, mem_objects[0], CL_FALSE,
+            0, sizeof(cl_uint4) * count, triangles.data(), 0, NULL, profile_event("upload triangles"));
+        errNum |= clEnqueueWriteBuffer(commandQueue, mem_objects[1], CL_FALSE,
+            0, sizeof(cl_float3) * vertices.size(), vertices.data(), 0, NULL, profile_event("upload vertices"));
+        if (errNum != CL_SUCCESS)
+        {
+            std::cerr << "Error writing batch buffers." << std::endl;
+            return false;
+        }
+
+        cl_uint triangles_size = (cl_uint)count;
+        errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_objects[0]);
+        errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_objects[1]);
+        errNum |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem_objects[2]);
+        errNum |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &triangles_size);
+        if (errNum != CL_SUCCESS)
+        {
+            std::cerr << "Error setting kernel arguments." << std::endl;
+            return false;
+        }
+
+        // Tune on the first batch, the rest reuse its choice
+        if (!tuned)
+        {
+            localSize = tune_local_size(commandQueue, device, kernel, count);
+            tuned = true;
+        }
+
+        errNum = enqueue_padded(commandQueue, kernel, count, localSize, 0, 0, NULL, profile_event("kernel"));
+        if (errNum != CL_SUCCESS)
+        {
+            std::cerr << "Error queuing kernel for execution." << std::endl;
+            return false;
+        }
+
+        errNum = clEnqueueReadBuffer(commandQueue, mem_objects[0], CL_TRUE,
+            0, sizeof(cl_uint4) * count, triangles.data(),
+            0, NULL, profile_event("readback triangles"));
+        if (errNum != CL_SUCCESS)
+        {
+            std::cerr << "Error reading result buffer." << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (triangles[i].w == 1)
+                flagged++;
+        }
+        total += count;
+        return true;
+    });
+
+    if (!streamed)
+    {
+        std::cerr << "Failed to stream " << fileName << "." << std::endl;
+        return false;
+    }
+
+    std::cout << "Streamed " << total << " triangles, " << flagged << " are small." << std::endl;
+    return true;
+}
+
+///
+//  Classify triangles_array in place on a device sharing
+//  memory with the host, whose buffers use the host arrays
+//
+//  Mapping the triangle buffer makes the kernel's flags
+//  visible in triangles_array without copying it
+//
+bool classify_mapped(cl_command_queue commandQueue, cl_kernel kernel,
+    cl_mem mem_objects[MEM_OBJECTS], size_t localSize)
+{
+    cl_int errNum = enqueue_padded(commandQueue, kernel, triangles_number, localSize,
+        0, 0, NULL, profile_event("kernel"));
+    if (errNum != CL_SUCCESS)
+    {
+        std::cerr << "Error queuing kernel for execution." << std::endl;
+        return false;
+    }
+
+    size_t bytes = sizeof(cl_uint4) * triangles_number;
+    void* mapped = clEnqueueMapBuffer(commandQueue, mem_objects[0], CL_TRUE, CL_MAP_READ,
+        0, bytes, 0, NULL, profile_event("readback map"), &errNum);
+    if (errNum != CL_SUCCESS || mapped == NULL)
+    {
+        std::cerr << "Error mapping result buffer." << std::endl;
+        return false;
+    }
+
+    // The mapping is the host array itself, copy
+    // only if the runtime chose otherwise
+    if (mapped != (void*)triangles_array)
+        memcpy(triangles_array, mapped, bytes);
+
+    errNum = clEnqueueUnmapMemObject(commandQueue, mem_objects[0], mapped, 0, NULL, NULL);
+    errNum |= clFinish(commandQueue);
+    if (errNum != CL_SUCCESS)
+    {
+        std::cerr << "Error unmapping result buffer." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///
+//  Classify triangles_array on a device with its own memory
+//  in chunks of PIPELINE_CHUNK triangles, so that transfers
+//  overlap with the kernel
+//
+//  The transfer queue uploads the vertices and every chunk
+//  without blocking, the kernel queue classifies a chunk
+//  once its upload and the vertices are done, and the
+//  transfer queue reads the chunk back once the kernel is
+//  done. Chunk i + 1 uploads while chunk i is classified
+//
+//  Without readBack the flags stay on the device for
+//  read_compacted
+//
+bool classify_pipelined(cl_command_queue transferQueue, cl_command_queue commandQueue,
+    cl_kernel kernel, cl_mem mem_objects[MEM_OBJECTS], size_t localSize, bool readBack)
+{
+    cl_int errNum;
+    std::vector<cl_event> events;
+
+    cl_event vertices = NULL;
+    errNum = clEnqueueWriteBuffer(transferQueue, mem_objects[1], CL_FALSE,
+        0, sizeof(cl_float3) * verticles_number, verticles_array, 0, NULL, &vertices);
+    if (errNum == CL_SUCCESS)
+    {
+        events.push_back(vertices);
+        profile_command("upload vertices", vertices);
+    }
+
+    for (size_t first = 0; first < triangles_number && errNum == CL_SUCCESS; first += PIPELINE_CHUNK)
+    {
+        size_t count = std::min(PIPELINE_CHUNK, triangles_number - first);
+        size_t offset = sizeof(cl_uint4) * first, bytes = sizeof(cl_uint4) * count;
+
+        cl_event ready[2] = { vertices, NULL };
+        errNum = clEnqueueWriteBuffer(transferQueue, mem_objects[0], CL_FALSE,
+            offset, bytes, triangles_array + first, 0, NULL, &ready[1]);
+        if (errNum != CL_SUCCESS)
+            break;
+        events.push_back(ready[1]);
+        profile_command("upload triangles", ready[1]);
+
+        // The padding of the chunk must not reach into the
+        // next one, which may not be uploaded yet
+        cl_uint end = (cl_uint)(first + count);
+        cl_event classified = NULL;
+        errNum = clSetKernelArg(kernel, 3, sizeof(cl_uint), &end);
+        errNum |= enqueue_padded(commandQueue, kernel, count, localSize, first,
+            2, ready, &classified);
+        if (errNum != CL_SUCCESS)
+            break;
+        events.push_back(classified);
+        profile_command("kernel", classified);
+
+        // Submit the kernel before the transfer queue
+        // waits on it
+        errNum = clFlush(commandQueue);
+        if (!readBack)
+            continue;
+
+        cl_event read = NULL;
+        errNum |= clEnqueueReadBuffer(transferQueue, mem_objects[0], CL_FALSE,
+            offset, bytes, triangles_array + first, 1, &classified, &read);
+        if (errNum != CL_SUCCESS)
+            break;
+        events.push_back(read);
+        profile_command("readback triangles", read);
+        errNum = clFlush(transferQueue);
+    }
+
+    // Wait for both queues even after a failure, since they
+    // may still be using triangles_array
+    cl_int finished = clFinish(transferQueue);
+    finished |= clFinish(commandQueue);
+    for (cl_event event : events)
+        clReleaseEvent(event);
+
+    if (errNum != CL_SUCCESS || finished != CL_SUCCESS)
+    {
+        std::cerr << "Error classifying triangles in chunks." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///
+//  Triangles per tile of classify_tiled: two tiles are in
+//  flight, each with its triangles and up to three vertices
+//  per triangle, within half of the device memory and the
+//  largest single allocation
+//
+size_t tile_triangles(cl_device_id device)
+{
+    cl_ulong maxAlloc = 0, globalMem = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, NULL);
+
+    size_t perTriangle = sizeof(cl_uint4) + 3 * sizeof(cl_float3);
+    cl_ulong tile = std::min(maxAlloc / (3 * sizeof(cl_float3)), globalMem / 2 / (2 * perTriangle));
+    return (size_t)std::max(std::min(tile, (cl_ulong)triangles_number), (cl_ulong)1);
+}
+
+///
+//  Whether the whole mesh fits in device memory as single
+//  buffers
+//
+bool fits_device(cl_device_id device)
+{
+    cl_ulong maxAlloc = 0, globalMem = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, NULL);
+
+    cl_ulong triangles = sizeof(cl_uint4) * (cl_ulong)triangles_number;
+    cl_ulong vertices = sizeof(cl_float3) * (cl_ulong)verticles_number;
+    return triangles <= maxAlloc && vertices <= maxAlloc && triangles + vertices <= globalMem;
+}
+
+///
+//  Classify triangles_array with set_is_small in tiles that
+//  fit in device memory however large the mesh is
+//
+//  Each tile uploads its triangles with indices remapped
+//  to the vertices they use, and only those vertices. Two
+//  sets of tile buffers alternate: the transfer queue
+//  uploads tile i + 1 while the kernel queue classifies
+//  tile i, and the host remaps tile i + 2 meanwhile, once
+//  tile i - 1 is back in its staging arrays
+//
+bool classify_tiled(cl_context context, cl_command_queue commandQueue, cl_device_id device,
+    cl_kernel kernel, cl_mem mem_objects[MEM_OBJECTS], cl_float min)
+{
+    size_t tile = tile_triangles(device);
+    size_t tiles = (triangles_number + tile - 1) / tile;
+
+    cl_command_queue transferQueue = clCreateCommandQueue(context, device, queue_properties(), NULL);
+    mem_objects[2] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_float), &min, NULL);
+    cl_mem buffers[2][2] = { { 0, 0 }, { 0, 0 } };
+    for (int set = 0; set < 2; set++)
+    {
+        buffers[set][0] = clCreateBuffer(context, CL_MEM_READ_WRITE,
+            sizeof(cl_uint4) * tile, NULL, NULL);
+        buffers[set][1] = clCreateBuffer(context, CL_MEM_READ_ONLY,
+            sizeof(cl_float3) * 3 * tile, NULL, NULL);
+    }
+
+    bool check = transferQueue != NULL && mem_objects[2] != NULL;
+    for (int set = 0; set < 2; set++)
+        check = check && buffers[set][0] != NULL && buffers[set][1] != NULL;
+    if (!check)
+        std::cerr << "Error creating memory objects" << std::endl;
+
+    // Host staging of each buffer set, and the tile index of
+    // every vertex of the mesh in the tile that last used it
+    std::vector<cl_uint4> triangles[2];
+    std::vector<cl_float3> vertices[2];
+    std::vector<cl_uint> local(verticles_number), stamp(verticles_number, (cl_uint)-1);
+    cl_event classified[2] = { NULL, NULL }, read[2] = { NULL, NULL };
+    std::vector<cl_event> events;
+    size_t localSize = 0;
+
+    // Put the flags of the tile last read into a set back
+    // into triangles_array
+    auto collect = [&](size_t i)
+    {
+        int set = i % 2;
+        if (clWaitForEvents(1, &read[set]) != CL_SUCCESS)
+            return false;
+        size_t first = i * tile;
+        for (size_t t = 0; t < triangles[set].size(); t++)
+            triangles_array[first + t].w = triangles[set][t].w;
+        return true;
+    };
+
+    for (size_t i = 0; i < tiles && check; i++)
+    {
+        int set = i % 2;
+        if (i >= 2 && !collect(i - 2))
+        {
+            check = false;
+            break;
+        }
+
+        size_t first = i * tile, count = std::min(tile, triangles_number - first);
+        double remapped = profile_clock();
+        triangles[set].resize(count);
+        vertices[set].clear();
+        for (size_t t = 0; t < count; t++)
+        {
+            const cl_uint4& source = triangles_array[first + t];
+            cl_uint* target = &triangles[set][t].x;
+            for (cl_uint v : { source.x, source.y, source.z })
+            {
+                if (stamp[v] != (cl_uint)i)
+                {
+                    stamp[v] = (cl_uint)i;
+                    local[v] = (cl_uint)vertices[set].size();
+                    vertices[set].push_back(verticles_array[v]);
+                }
+                *target++ = local[v];
+            }
+            triangles[set][t].w = 0;
+        }
+        profile_host("remap tile", remapped);
+
+        cl_event written[2] = { NULL, NULL };
+        cl_int errNum = clEnqueueWriteBuffer(transferQueue, buffers[set][0], CL_FALSE,
+            0, sizeof(cl_uint4) * count, triangles[set].data(), 0, NULL, &written[0]);
+        errNum |= clEnqueueWriteBuffer(transferQueue, buffers[set][1], CL_FALSE,
+            0, sizeof(cl_float3) * vertices[set].size(), vertices[set].data(), 0, NULL, &written[1]);
+        errNum |= clFlush(transferQueue);
+        if (errNum != CL_SUCCESS)
+        {
+            check = false;
+            break;
+        }
+        events.push_back(written[0]);
+        events.push_back(written[1]);
+        profile_command("upload triangles", written[0]);
+        profile_command("upload vertices", written[1]);
+
+        cl_uint triangles_size = (cl_uint)count;
+        errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffers[set][0]);
+        errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &buffers[set][1]);
+        errNum |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem_objects[2]);
+        errNum |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &triangles_size);
+
+        // Tune on the first tile once it is on the device
+        if (i == 0 && errNum == CL_SUCCESS)
+        {
+            errNum = clWaitForEvents(2, written);
+            if (errNum == CL_SUCCESS)
+                localSize = tune_local_size(commandQueue, device, kernel, count);
+        }
+
+        errNum |= enqueue_padded(commandQueue, kernel, count, localSize, 0, 2, written, &classified[set]);
+        if (errNum != CL_SUCCESS)
+        {
+            check = false;
+            break;
+        }
+        events.push_back(classified[set]);
+        profile_command("kernel", classified[set]);
+        errNum = clFlush(commandQueue);
+
+        // Read back the previous tile now that this one is
+        // queued for upload ahead of it
+        if (i >= 1)
+        {
+            int previous = (i - 1) % 2;
+            errNum |= clEnqueueReadBuffer(transferQueue, buffers[previous][0], CL_FALSE,
+                0, sizeof(cl_uint4) * triangles[previous].size(), triangles[previous].data(),
+                1, &classified[previous], &read[previous]);
+            if (errNum == CL_SUCCESS)
+            {
+                events.push_back(read[previous]);
+                profile_command("readback triangles", read[previous]);
+            }
+        }
+        if (errNum != CL_SUCCESS)
+            check = false;
+    }
+
+    // The readback of the last tile, in order after the
+    // readback of the tile before it
+    if (check && tiles > 0)
+    {
+        int last = (tiles - 1) % 2;
+        if (clEnqueueReadBuffer(transferQueue, buffers[last][0], CL_FALSE,
+                0, sizeof(cl_uint4) * triangles[last].size(), triangles[last].data(),
+                1, &classified[last], &read[last]) == CL_SUCCESS)
+        {
+            events.push_back(read[last]);
+            profile_command("readback triangles", read[last]);
+        }
+        else
+            check = false;
+    }
+
+    if (transferQueue != NULL)
+        clFinish(transferQueue);
+    clFinish(commandQueue);
+
+    for (size_t i = tiles >= 2 ? tiles - 2 : 0; i < tiles && check; i++)
+        check = collect(i);
+
+    for (cl_event event : events)
+        clReleaseEvent(event);
+    for (int set = 0; set < 2; set++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (buffers[set][i] != 0)
+                clReleaseMemObject(buffers[set][i]);
+        }
+    }
+    if (transferQueue != NULL)
+        clReleaseCommandQueue(transferQueue);
+
+    if (!check)
+    {
+        std::cerr << "Error classifying triangles in tiles." << std::endl;
+        return false;
+    }
+
+    std::cout << "Classified " << triangles_number << " triangles in " << tiles
+        << " tiles of " << tile << "." << std::endl;
+    return true;
+}
+
+///
+//  Largest power of two work-group size up to 256 a kernel
+//  can run with on a device
+//
+size_t compact_group_size(cl_kernel kernel, cl_device_id device)
+{
+    size_t maxSize = 1;
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(size_t), &maxSize, NULL);
+
+    size_t size = 1;
+    while (size * 2 <= std::min(maxSize, (size_t)256))
+        size *= 2;
+    return size;
+}
+
+///
+//  Bring the flags set_is_small left in the triangle buffer
+//  back into triangles_array, reading only the indices of
+//  the flagged triangles or one bit per triangle rather
+//  than the whole buffer
+//
+//  For OUTPUT_INDICES count_flagged, scan_counts and
+//  write_flagged compact the indices on the device, then
+//  the count and the indices are read. For OUTPUT_BITMASK
+//  pack_flags packs 32 flags to a word and the words are
+//  read. The flags in triangles_array must be clear
+//
+bool read_compacted(cl_context context, cl_command_queue commandQueue, cl_device_id device,
+    cl_program program, cl_mem triangles, output_mode mode)
+{
+    if (triangles_number == 0)
+        return true;
+
+    cl_int errNum = CL_SUCCESS;
+    cl_uint triangles_size = (cl_uint)triangles_number;
+    cl_kernel kernels[3] = { 0, 0, 0 };
+    cl_mem buffers[2] = { 0, 0 };
+    size_t readBytes = 0;
+    bool check = false;
+
+    if (mode == OUTPUT_INDICES)
+    {
+        cl_uint block = (cl_uint)COMPACT_BLOCK;
+        cl_uint groups = (cl_uint)((triangles_number + COMPACT_BLOCK - 1) / COMPACT_BLOCK);
+        kernels[0] = clCreateKernel(program, "count_flagged", NULL);
+        kernels[1] = clCreateKernel(program, "scan_counts", NULL);
+        kernels[2] = clCreateKernel(program, "write_flagged", NULL);
+        buffers[0] = clCreateBuffer(context, CL_MEM_READ_WRITE,
+            sizeof(cl_uint) * (groups + 1), NULL, NULL);
+        buffers[1] = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+            sizeof(cl_uint) * triangles_number, NULL, NULL);
+
+        if (kernels[0] != NULL && kernels[1] != NULL && kernels[2] != NULL
+            && buffers[0] != NULL && buffers[1] != NULL)
+        {
+            size_t localSize = std::min(compact_group_size(kernels[0], device),
+                compact_group_size(kernels[2], device));
+            size_t globalWorkSize[1] = { groups * localSize };
+            size_t localWorkSize[1] = { localSize };
+            size_t single[1] = { 1 };
+
+            errNum = clSetKernelArg(kernels[0], 0, sizeof(cl_mem), &triangles);
+            errNum |= clSetKernelArg(kernels[0], 1, sizeof(cl_uint), &triangles_size);
+            errNum |= clSetKernelArg(kernels[0], 2, sizeof(cl_uint), &block);
+            errNum |= clSetKernelArg(kernels[0], 3, sizeof(cl_mem), &buffers[0]);
+            errNum |= clSetKernelArg(kernels[0], 4, sizeof(cl_uint) * localSize, NULL);
+            errNum |= clSetKernelArg(kernels[1], 0, sizeof(cl_mem), &buffers[0]);
+            errNum |= clSetKernelArg(kernels[1], 1, sizeof(cl_uint), &groups);
+            errNum |= clSetKernelArg(kernels[2], 0, sizeof(cl_mem), &triangles);
+            errNum |= clSetKernelArg(kernels[2], 1, sizeof(cl_uint), &triangles_size);
+            errNum |= clSetKernelArg(kernels[2], 2, sizeof(cl_uint), &block);
+            errNum |= clSetKernelArg(kernels[2], 3, sizeof(cl_mem), &buffers[0]);
+            errNum |= clSetKernelArg(kernels[2], 4, sizeof(cl_mem), &buffers[1]);
+            errNum |= clSetKernelArg(kernels[2], 5, sizeof(cl_uint) * localSize, NULL);
+
+            errNum |= clEnqueueNDRangeKernel(commandQueue, kernels[0], 1, NULL,
+                globalWorkSize, localWorkSize, 0, NULL, profile_event("kernel count_flagged"));
+            errNum |= clEnqueueNDRangeKernel(commandQueue, kernels[1], 1, NULL,
+                single, single, 0, NULL, profile_event("kernel scan_counts"));
+            errNum |= clEnqueueNDRangeKernel(commandQueue, kernels[2], 1, NULL,
+                globalWorkSize, localWorkSize, 0, NULL, profile_event("kernel write_flagged"));
+
+            cl_uint count = 0;
+            errNum |= clEnqueueReadBuffer(commandQueue, buffers[0], CL_TRUE,
+                sizeof(cl_uint) * groups, sizeof(cl_uint), &count, 0, NULL,
+                profile_event("readback flagged count"));
+
+            std::vector<cl_uint> flagged(count);
+            if (errNum == CL_SUCCESS && count > 0)
+                errNum = clEnqueueReadBuffer(commandQueue, buffers[1], CL_TRUE,
+                    0, sizeof(cl_uint) * count, flagged.data(), 0, NULL,
+                    profile_event("readback flagged indices"));
+
+            if (errNum == CL_SUCCESS)
+            {
+                for (cl_uint index : flagged)
+                    triangles_array[index].w = 1;
+                readBytes = sizeof(cl_uint) * (count + 1);
+                check = true;
+            }
+        }
+    }
+    else
+    {
+        size_t words = (triangles_number + 31) / 32;
+        kernels[0] = clCreateKernel(program, "pack_flags", NULL);
+        buffers[0] = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
+            sizeof(cl_uint) * words, NULL, NULL);
+
+        if (kernels[0] != NULL && buffers[0] != NULL)
+        {
+            errNum = clSetKernelArg(kernels[0], 0, sizeof(cl_mem), &triangles);
+            errNum |= clSetKernelArg(kernels[0], 1, sizeof(cl_uint), &triangles_size);
+            errNum |= clSetKernelArg(kernels[0], 2, sizeof(cl_mem), &buffers[0]);
+            errNum |= enqueue_padded(commandQueue, kernels[0], words, 0,
+                0, 0, NULL, profile_event("kernel pack_flags"));
+
+            std::vector<cl_uint> mask(words);
+            errNum |= clEnqueueReadBuffer(commandQueue, buffers[0], CL_TRUE,
+                0, sizeof(cl_uint) * words, mask.data(), 0, NULL, profile_event("readback bitmask"));
+
+            if (errNum == CL_SUCCESS)
+            {
+                for (size_t i = 0; i < triangles_number; i++)
+                    triangles_array[i].w = (mask[i / 32] >> (i % 32)) & 1;
+                readBytes = sizeof(cl_uint) * words;
+                check = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (kernels[i] != 0)
+            clReleaseKernel(kernels[i]);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        if (buffers[i] != 0)
+            clReleaseMemObject(buffers[i]);
+    }
+
+    if (!check)
+    {
+        std::cerr << "Error reading compacted flags." << std::endl;
+        return false;
+    }
+
+    std::cout << "Read " << readBytes << " bytes of flags instead of "
+        << sizeof(cl_uint4) * triangles_number << "." << std::endl;
+    return true;
+}
+
+///
+//  Cleanup any created OpenCL resources
+//
+void Cleanup(cl_context context, cl_command_queue commandQueue,
+             cl_program program, cl_kernel kernel, cl_mem *memObjects)
+{
+    for (int i = 0; i < MEM_OBJECTS; i++)
+    {
+        if (memObjects[i] != 0)
+            clReleaseMemObject(memObjects[i]);
+    }
+    if (commandQueue != 0)
+        clReleaseCommandQueue(commandQueue);
+
+    if (kernel != 0)
+        clReleaseKernel(kernel);
+
+    if (program != 0)
+        clReleaseProgram(program);
+
+    if (context != 0)
+        clReleaseContext(context);
+
+}
+
+///
+//  An OpenCL device with its own context and everything
+//  set_is_small needs to run there, and the contiguous part
+//  of triangles_array it classifies
+//
+struct device_worker
+{
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue commandQueue;
+    cl_program program;
+    cl_kernel kernel;
+    cl_mem mem_objects[MEM_OBJECTS];
+    size_t localSize;
+    double throughput;
+    size_t first, count;
+    device_worker() : device(0), context(0), commandQueue(0), program(0), kernel(0),
+        mem_objects(), localSize(0), throughput(0.0), first(0), count(0) {}
+};
+
+///
+//  Create a worker on every device of every platform,
+//  skipping the devices that fail to set up
+//
+std::vector<device_worker> create_workers()
+{
+    std::vector<device_worker> workers;
+
+    cl_uint numPlatforms = 0;
+    if (clGetPlatformIDs(0, NULL, &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+    {
+        std::cerr << "Failed to find any OpenCL platforms." << std::endl;
+        return workers;
+    }
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    clGetPlatformIDs(numPlatforms, platforms.data(), NULL);
+
+    for (cl_platform_id platform : platforms)
+    {
+        cl_uint numDevices = 0;
+        if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices) != CL_SUCCESS
+            || numDevices == 0)
+            continue;
+        std::vector<cl_device_id> devices(numDevices);
+        clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), NULL);
+
+        for (cl_device_id device : devices)
+        {
+            device_worker worker;
+            worker.device = device;
+
+            cl_context_properties contextProperties[] =
+            {
+                CL_CONTEXT_PLATFORM,
+                (cl_context_properties)platform,
+                0
+            };
+            worker.context = clCreateContext(contextProperties, 1, &device, NULL, NULL, NULL);
+            if (worker.context != NULL)
+                worker.commandQueue = clCreateCommandQueue(worker.context, device, queue_properties(), NULL);
+            if (worker.commandQueue != NULL)
+                worker.program = CreateProgram(worker.context, device, "kernel.cl");
+            if (worker.program != NULL)
+                worker.kernel = clCreateKernel(worker.program, "set_is_small", NULL);
+            if (worker.kernel == NULL)
+            {
+                std::cerr << "Skipping device " << device_string(device, CL_DEVICE_NAME)
+                    << ", failed to set it up." << std::endl;
+                Cleanup(worker.context, worker.commandQueue, worker.program, worker.kernel,
+                    worker.mem_objects);
+                continue;
+            }
+            workers.push_back(worker);
+        }
+    }
+
+    return workers;
 }
 
 ///
-//  Create a command queue on the first device available on the
-//  context
+//  Set the arguments of a worker's kernel for count
+//  triangles in its triangle buffer
 //
-cl_command_queue CreateCommandQueue(cl_context context, cl_device_id *device)
+cl_int set_worker_args(device_worker& worker, size_t count)
+{
+    cl_uint triangles_size = (cl_uint)count;
+    cl_int errNum = clSetKernelArg(worker.kernel, 0, sizeof(cl_mem), &worker.mem_objects[0]);
+    errNum |= clSetKernelArg(worker.kernel, 1, sizeof(cl_mem), &worker.mem_objects[1]);
+    errNum |= clSetKernelArg(worker.kernel, 2, sizeof(cl_mem), &worker.mem_objects[2]);
+    errNum |= clSetKernelArg(worker.kernel, 3, sizeof(cl_uint), &triangles_size);
+    return errNum;
+}
+
+///
+//  Measure how many triangles per second a worker
+//  classifies, upload and readback included, on the first
+//  probe triangles of triangles_array
+//
+bool probe_worker(device_worker& worker, size_t probe, cl_float min)
 {
     cl_int errNum;
-    cl_device_id *devices;
-    cl_command_queue commandQueue = NULL;
-    size_t deviceBufferSize = -1;
 
-    // First get the size of the devices buffer
-    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &deviceBufferSize);
+    worker.mem_objects[0] = clCreateBuffer(worker.context, CL_MEM_READ_WRITE,
+        sizeof(cl_uint4) * probe, NULL, NULL);
+    worker.mem_objects[1] = clCreateBuffer(worker.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_float3) * verticles_number, verticles_array, NULL);
+    worker.mem_objects[2] = clCreateBuffer(worker.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(cl_float), &min, NULL);
+    if (worker.mem_objects[0] == NULL || worker.mem_objects[1] == NULL
+        || worker.mem_objects[2] == NULL)
+        return false;
+
+    errNum = clEnqueueWriteBuffer(worker.commandQueue, worker.mem_objects[0], CL_TRUE,
+        0, sizeof(cl_uint4) * probe, triangles_array, 0, NULL, NULL);
+    errNum |= set_worker_args(worker, probe);
     if (errNum != CL_SUCCESS)
+        return false;
+    worker.localSize = tune_local_size(worker.commandQueue, worker.device, worker.kernel, probe);
+
+    // Best of three runs, each one restoring the flags
+    std::vector<cl_uint4> result(probe);
+    double fastest = -1.0;
+    for (int run = 0; run < 3; run++)
     {
-        std::cerr << "Failed call to clGetContextInfo(...,GL_CONTEXT_DEVICES,...)";
-        return NULL;
+        auto start = std::chrono::steady_clock::now();
+        errNum = clEnqueueWriteBuffer(worker.commandQueue, worker.mem_objects[0], CL_FALSE,
+            0, sizeof(cl_uint4) * probe, triangles_array, 0, NULL, NULL);
+        errNum |= enqueue_padded(worker.commandQueue, worker.kernel, probe, worker.localSize);
+        errNum |= clEnqueueReadBuffer(worker.commandQueue, worker.mem_objects[0], CL_TRUE,
+            0, sizeof(cl_uint4) * probe, result.data(), 0, NULL, NULL);
+        if (errNum != CL_SUCCESS)
+            return false;
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        if (fastest < 0.0 || seconds.count() < fastest)
+            fastest = seconds.count();
     }
 
-    if (deviceBufferSize <= 0)
+    worker.throughput = probe / std::max(fastest, 1e-9);
+
+    clReleaseMemObject(worker.mem_objects[0]);
+    worker.mem_objects[0] = 0;
+    return true;
+}
+
+///
+//  Classify triangles_array with set_is_small on every
+//  OpenCL device of every platform at once
+//
+//  Each device first classifies the same probe slice to
+//  measure its throughput, then gets a contiguous chunk of
+//  the triangles sized in proportion to it. The chunks are
+//  queued on all devices before waiting on any of them and
+//  read back into their place in triangles_array
+//
+bool classify_devices(cl_float min)
+{
+    std::vector<device_worker> workers = create_workers();
+    if (workers.empty())
     {
-        std::cerr << "No devices available.";
-        return NULL;
+        std::cerr << "No OpenCL device to classify on." << std::endl;
+        return false;
     }
 
-    // Allocate memory for the devices buffer
-    devices = new cl_device_id[deviceBufferSize / sizeof(cl_device_id)];
-    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, deviceBufferSize, devices, NULL);
-    if (errNum != CL_SUCCESS)
+    bool check = true;
+    size_t probe = std::min(triangles_number, std::max(triangles_number / 64, (size_t)1 << 16));
+    double throughput = 0.0, probed = profile_clock();
+    for (size_t i = 0; i < workers.size() && probe > 0; i++)
     {
-        delete [] devices;
-        std::cerr << "Failed to get device IDs";
-        return NULL;
+        if (!probe_worker(workers[i], probe, min))
+        {
+            std::cerr << "Failed to probe device "
+                << device_string(workers[i].device, CL_DEVICE_NAME) << "." << std::endl;
+            check = false;
+            break;
+        }
+        throughput += workers[i].throughput;
     }
+    profile_host("probe devices", probed);
 
-    // In this example, we just choose the first available device.  In a
-    // real program, you would likely use all available devices or choose
-    // the highest performance device based on OpenCL device queries
-    commandQueue = clCreateCommandQueue(context, devices[0], 0, NULL);
-    if (commandQueue == NULL)
+    auto start = std::chrono::steady_clock::now();
+
+    // Split the triangles by throughput, the last device
+    // takes what rounding leaves
+    size_t first = 0;
+    for (size_t i = 0; i < workers.size() && check && probe > 0; i++)
     {
-        delete [] devices;
-        std::cerr << "Failed to create commandQueue for device 0";
-        return NULL;
+        device_worker& worker = workers[i];
+        worker.first = first;
+        worker.count = i + 1 == workers.size() ? triangles_number - first
+            : std::min(triangles_number - first,
+                (size_t)(triangles_number * (worker.throughput / throughput)));
+        first += worker.count;
+        if (worker.count == 0)
+            continue;
+
+        worker.mem_objects[0] = clCreateBuffer(worker.context, CL_MEM_READ_WRITE,
+            sizeof(cl_uint4) * worker.count, NULL, NULL);
+        if (worker.mem_objects[0] == NULL)
+        {
+            std::cerr << "Error creating memory objects" << std::endl;
+            check = false;
+            break;
+        }
+
+        std::string name = device_string(worker.device, CL_DEVICE_NAME);
+        cl_int errNum = clEnqueueWriteBuffer(worker.commandQueue, worker.mem_objects[0], CL_FALSE,
+            0, sizeof(cl_uint4) * worker.count, triangles_array + worker.first, 0, NULL,
+            profile_event("upload triangles " + name));
+        errNum |= set_worker_args(worker, worker.count);
+        errNum |= enqueue_padded(worker.commandQueue, worker.kernel, worker.count, worker.localSize,
+            0, 0, NULL, profile_event("kernel " + name));
+        errNum |= clEnqueueReadBuffer(worker.commandQueue, worker.mem_objects[0], CL_FALSE,
+            0, sizeof(cl_uint4) * worker.count, triangles_array + worker.first, 0, NULL,
+            profile_event("readback triangles " + name));
+        errNum |= clFlush(worker.commandQueue);
+        if (errNum != CL_SUCCESS)
+        {
+            std::cerr << "Error queuing work on device "
+                << device_string(worker.device, CL_DEVICE_NAME) << "." << std::endl;
+            check = false;
+            break;
+        }
     }
 
-    *device = devices[0];
-    delete [] devices;
-    return commandQueue;
+    // Wait for every device, even after a failure, since
+    // they may still be writing into triangles_array
+    for (device_worker& worker : workers)
+    {
+        if (clFinish(worker.commandQueue) != CL_SUCCESS)
+            check = false;
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    if (check)
+    {
+        size_t flagged = 0;
+        for (size_t i = 0; i < triangles_number; i++)
+        {
+            if (triangles_array[i].w == 1)
+                flagged++;
+        }
+
+        for (device_worker& worker : workers)
+        {
+            std::cout << device_string(worker.device, CL_DEVICE_NAME) << ": "
+                << worker.count << " triangles, "
+                << (size_t)worker.throughput << " triangles/s measured" << std::endl;
+        }
+        std::cout << "Classified " << triangles_number << " triangles on " << workers.size()
+            << " devices in " << seconds.count() << " s, " << flagged << " are small." << std::endl;
+    }
+
+    for (device_worker& worker : workers)
+        Cleanup(worker.context, worker.commandQueue, worker.program, worker.kernel,
+            worker.mem_objects);
+    return check;
 }
 
 ///
-//  Create an OpenCL program from the kernel source file
+//  Classify triangles_array with set_is_small on the CPU,
+//  with the widest instruction set it has and all of its
+//  cores
 //
-cl_program CreateProgram(cl_context context, cl_device_id device, const char* fileName)
+bool classify_cpu(cl_float min)
 {
-    cl_int errNum;
-    cl_program program;
+    cpu_isa isa = cpu_detect_isa();
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
 
-    std::ifstream kernelFile(fileName, std::ios::in);
-    if (!kernelFile.is_open())
-    {
-        std::cerr << "Failed to open file for reading: " << fileName << std::endl;
-        return NULL;
-    }
+    auto start = std::chrono::steady_clock::now();
+    cpu_soa soa;
+    cpu_make_soa(soa, (const float*)verticles_array, verticles_number, threads);
+    size_t flagged = cpu_set_is_small((uint32_t*)triangles_array, triangles_number, soa,
+        min, isa, threads);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    profile_host("classify cpu", std::chrono::duration<double>(start - profile_origin).count());
 
-    std::ostringstream oss;
-    oss << kernelFile.rdbuf();
+    std::cout << "Classified " << triangles_number << " triangles on the CPU with "
+        << cpu_isa_name(isa) << " on " << threads << " threads in " << seconds.count()
+        << " s, " << flagged << " are small." << std::endl;
+    return true;
+}
 
-    std::string srcStdStr = oss.str();
-    const char *srcStr = srcStdStr.c_str();
-    program = clCreateProgramWithSource(context, 1,
-                                        (const char**)&srcStr,
-                                        NULL, NULL);
-    if (program == NULL)
-    {
-        std::cerr << "Failed to create CL program from source." << std::endl;
-        return NULL;
-    }
+///
+//  Check that every instruction set of the CPU engine flags
+//  the same triangles as set_is_small did on the device,
+//  with the device's flags in triangles_array
+//
+bool check_parity(cl_float min)
+{
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_soa soa;
+    cpu_make_soa(soa, (const float*)verticles_array, verticles_number, threads);
 
-    errNum = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (errNum != CL_SUCCESS)
+    bool check = true;
+    std::vector<cl_uint4> triangles(triangles_number);
+    for (int isa = CPU_SCALAR; isa <= cpu_detect_isa(); isa++)
     {
-        // Determine the reason for the error
-        char buildLog[16384];
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG,
-                              sizeof(buildLog), buildLog, NULL);
+        for (size_t i = 0; i < triangles_number; i++)
+        {
+            triangles[i] = triangles_array[i];
+            triangles[i].w = 0;
+        }
+        cpu_set_is_small((uint32_t*)triangles.data(), triangles_number, soa, min,
+            (cpu_isa)isa, threads);
 
-        std::cerr << "Error in kernel: " << std::endl;
-        std::cerr << buildLog;
-        clReleaseProgram(program);
-        return NULL;
+        size_t mismatches = 0, first = triangles_number;
+        for (size_t i = 0; i < triangles_number; i++)
+        {
+            if ((triangles[i].w != 0) != (triangles_array[i].w != 0))
+            {
+                if (mismatches++ == 0)
+                    first = i;
+            }
+        }
+
+        std::cout << "Parity " << cpu_isa_name((cpu_isa)isa) << ": ";
+        if (mismatches == 0)
+            std::cout << "all " << triangles_number << " triangles match" << std::endl;
+        else
+            std::cout << mismatches << " triangles differ, the first is " << first << std::endl;
+        check = check && mismatches == 0;
     }
+    return check;
+}
 
-    return program;
+///
+//  Sum of the areas of a mesh, in double so that millions
+//  of small triangles still add up
+//
+double surface_area(const cl_uint4* triangles, size_t count, const cl_float3* vertices)
+{
+    double area = 0.0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const cl_float3 &a = vertices[triangles[i].x], &b = vertices[triangles[i].y], &c = vertices[triangles[i].z];
+        double ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+        double vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+        double nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        area += 0.5 * sqrt(nx * nx + ny * ny + nz * nz);
+    }
+    return area;
 }
 
 ///
-//  Create memory objects used as the arguments to the kernel
-//  The kernel takes four arguments: triangles_array - input and output;
-//  verticles_array, triangles_size, verticles_size, min - input;
+//  Replace the loaded mesh with its simplification to
+//  simplify_ratio of the triangles, report what that cost
+//  and how much of the surface it kept, and write it to
+//  SIMPLIFIED_FILE. Dropping the triangles set_is_small
+//  flags is the cheaper way to a lighter mesh, this one
+//  keeps the surface closed
 //
-bool create_mem_objects(cl_context context, cl_mem mem_objects[3],
-    cl_uint4* triangles_array, cl_float3* verticles_array,
-    size_t *triangles_size, size_t *verticles_size, cl_float *min)
+bool simplify_mesh()
 {
-    mem_objects[0] = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-        sizeof(cl_uint4) * (*triangles_size), triangles_array, NULL);
-    mem_objects[1] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        sizeof(cl_float3) * (*verticles_size), verticles_array, NULL);
-    mem_objects[2] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        sizeof(cl_float), min, NULL);
+    double start = profile_clock();
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    qem_mesh simplified;
+    qem_simplify(simplified, (const uint32_t*)triangles_array, triangles_number,
+        (const float*)verticles_array, verticles_number, simplify_ratio, threads, 0);
+    double seconds = profile_clock() - start;
+    profile_host("simplify", start);
 
-    bool check = true;
-    for (int i = 0; i < 3; i++)
-        if (mem_objects[i] == NULL)
-            check = false;
-    if (!check)
+    size_t count = simplified.triangles.size() / 4, vertexCount = simplified.vertices.size() / 4;
+    cl_uint4* triangles = (cl_uint4*)objl::AlignedAlloc(sizeof(cl_uint4) * std::max<size_t>(count, 1), HOST_ALIGNMENT);
+    cl_float3* vertices = (cl_float3*)objl::AlignedAlloc(sizeof(cl_float3) * std::max<size_t>(vertexCount, 1), HOST_ALIGNMENT);
+    if (triangles == NULL || vertices == NULL)
     {
-        std::cerr << "Error creating memory objects" << std::endl;
+        std::cerr << "Failed to allocate the simplified mesh." << std::endl;
+        objl::AlignedFree(triangles);
+        objl::AlignedFree(vertices);
         return false;
     }
+    memcpy(triangles, simplified.triangles.data(), sizeof(cl_uint4) * count);
+    memcpy(vertices, simplified.vertices.data(), sizeof(cl_float3) * vertexCount);
+    for (size_t i = 0; i < count; i++)
+        triangles[i].w = 0;
+
+    double before = surface_area(triangles_array, triangles_number, verticles_array);
+    double after = surface_area(triangles, count, vertices);
+    std::cout << "Simplified " << triangles_number << " triangles and " << verticles_number << " vertices to "
+        << count << " and " << vertexCount << " in " << seconds * 1000.0 << " ms on " << threads
+        << " threads, error " << simplified.error << ", surface kept "
+        << (before > 0.0 ? 100.0 * after / before : 100.0) << "%." << std::endl;
 
+    objl::AlignedFree(triangles_array);
+    objl::AlignedFree(verticles_array);
+    triangles_array = triangles;
+    verticles_array = vertices;
+    triangles_number = count;
+    verticles_number = vertexCount;
+
+    std::ofstream file(SIMPLIFIED_FILE);
+    for (size_t v = 0; v < verticles_number; v++)
+        file << "v " << verticles_array[v].x << " " << verticles_array[v].y << " " << verticles_array[v].z << "\n";
+    for (size_t i = 0; i < triangles_number; i++)
+        file << "f " << triangles_array[i].x + 1 << " " << triangles_array[i].y + 1 << " " << triangles_array[i].z + 1 << "\n";
+    if (!file)
+        std::cerr << "Failed to write " << SIMPLIFIED_FILE << "." << std::endl;
     return true;
 }
 
 ///
-//  Cleanup any created OpenCL resources
+//  Load an .obj file into triangles_array and
+//  verticles_array, simplified with --simplify
 //
-void Cleanup(cl_context context, cl_command_queue commandQueue,
-             cl_program program, cl_kernel kernel, cl_mem *memObjects)
+bool load_mesh(const char* fileName)
 {
-    for (int i = 0; i < 3; i++)
+    // Initialize Loader, sharing vertices between the faces
+    // of a mesh so that each one is uploaded only once, and
+    // keeping a binary cache next to the .obj file so that
+    // later runs skip parsing it
+    objl::Loader Loader;
+    Loader.WeldVertices = true;
+    Loader.UseBinaryCache = true;
+
+    // Load .obj File straight into page aligned kernel
+    // argument arrays, with the triangle flag in .w cleared
+    objl::BufferSink sink;
+    sink.Allocate = [](objl::BufferSink& sink, size_t vertexCount, size_t triangleCount)
     {
-        if (memObjects[i] != 0)
-            clReleaseMemObject(memObjects[i]);
-    }
-    if (commandQueue != 0)
-        clReleaseCommandQueue(commandQueue);
+        triangles_array = (cl_uint4*)objl::AlignedAlloc(sizeof(cl_uint4) * triangleCount, HOST_ALIGNMENT);
+        verticles_array = (cl_float3*)objl::AlignedAlloc(sizeof(cl_float3) * vertexCount, HOST_ALIGNMENT);
+        if (triangles_array == NULL || verticles_array == NULL)
+            return false;
 
-    if (kernel != 0)
-        clReleaseKernel(kernel);
+        triangles_number = triangleCount;
+        verticles_number = vertexCount;
 
-    if (program != 0)
-        clReleaseProgram(program);
+        sink.Triangles = (cl_uint*)triangles_array;
+        sink.TriangleStride = 4;
+        sink.X = (cl_float*)verticles_array;
+        sink.Y = sink.X + 1;
+        sink.Z = sink.X + 2;
+        sink.PositionStride = 4;
+        return true;
+    };
 
-    if (context != 0)
-        clReleaseContext(context);
+    double start = profile_clock();
+    bool loaded = Loader.LoadFileInto(fileName, sink);
+    profile_host("load obj", start);
+
+    if (loaded && simplify_ratio > 0.0 && simplify_ratio < 1.0)
+        loaded = simplify_mesh();
+
+    face_normals.clear();
+    smooth_normals.clear();
+    if (loaded && !device_normals)
+        compute_normals();
+    return loaded;
+}
+
+///
+//  Show the loaded mesh until the window is closed
+//
+void show_mesh(int* argc, char* argv[])
+{
+    // initialize rendering with solid body
+    render_mode = true;
+    compute_normals();
+    init_lods();
+    bool lods = start_lods();
 
+    int window;
+    glutInit(argc, argv);
+    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_ALPHA | GLUT_DEPTH);
+    glutInitWindowSize(960, 720);
+    glutInitWindowPosition(0, 0);
+    window = glutCreateWindow("3d_check");
+    init();
+    upload_mesh();
+    init_frame_stats();
+    glutDisplayFunc(display);
+    glutReshapeFunc(reshape);
+    glutSpecialFunc(arrow_keys);
+    glutKeyboardFunc(keyboard);
+    if (lods)
+        glutTimerFunc(LOD_POLL_MS, adopt_lods, 0);
+    glutMainLoop();
 }
 
 int main(int argc, char* argv[])
@@ -376,15 +3167,158 @@ int main(int argc, char* argv[])
     cl_program program = 0;
     cl_device_id device = 0;
     cl_kernel kernel = 0;
-    cl_mem mem_objects[3] = { 0, 0, 0 };
+    cl_mem mem_objects[MEM_OBJECTS] = { 0 };
     cl_int errNum;
 
-    // Create an OpenCL context on first available platform
-    context = CreateContext();
-    if (context == NULL)
+    // Command line: [--stream | --devices] [--output full|indices|bitmask]
+    // [--filter criteria | --sweep thresholds] [--tiled] [--cpu]
+    // [--parity] [--profile] [--device-normals] [--hud]
+    // [--simplify ratio] [--lod] [file.obj],
+    // --stream classifies the file in bounded batches instead
+    // of loading and showing it whole, --devices classifies it
+    // on all OpenCL devices at once instead of the first,
+    // --output picks what the device sends back when it has
+    // its own memory, --filter replaces set_is_small with the
+    // criteria of parse_filter for a whole file on one device,
+    // --sweep classifies such a file with each of a list of
+    // min values in one launch, --tiled classifies in tiles
+    // even when the mesh fits on the device, --cpu classifies
+    // on the CPU as is done without an OpenCL platform,
+    // --parity checks the CPU engine against the device,
+    // --profile times every transfer, kernel and host phase
+    // and writes them to PROFILE_FILE, --device-normals
+    // computes the normals of a whole file on one device,
+    // --hud opens the viewer with the frame-time HUD shown,
+    // --simplify reduces a whole file to ratio of its
+    // triangles before classifying it, and --lod builds the
+    // viewer's coarser levels even above LOD_MAX_TRIANGLES
+    bool stream = false, devices = false, tiled = false, cpu = false, parity = false;
+    output_mode output = OUTPUT_FULL;
+    filter_params filter;
+    std::vector<cl_float> thresholds;
+    const char* fileName = "box_stack.obj";
+    for (int i = 1; i < argc; i++)
     {
-        std::cerr << "Failed to create OpenCL context." << std::endl;
-        return 1;
+        if (strcmp(argv[i], "--stream") == 0)
+            stream = true;
+        else if (strcmp(argv[i], "--devices") == 0)
+            devices = true;
+        else if (strcmp(argv[i], "--tiled") == 0)
+            tiled = true;
+        else if (strcmp(argv[i], "--cpu") == 0)
+            cpu = true;
+        else if (strcmp(argv[i], "--parity") == 0)
+            parity = true;
+        else if (strcmp(argv[i], "--profile") == 0)
+            profiling = true;
+        else if (strcmp(argv[i], "--device-normals") == 0)
+            device_normals = true;
+        else if (strcmp(argv[i], "--hud") == 0)
+            frame_stats.shown = true;
+        else if (strcmp(argv[i], "--lod") == 0)
+            force_lods = true;
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "indices") == 0)
+                output = OUTPUT_INDICES;
+            else if (strcmp(argv[i], "bitmask") == 0)
+                output = OUTPUT_BITMASK;
+            else
+                output = OUTPUT_FULL;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            if (!parse_filter(argv[++i], filter))
+                return 1;
+        }
+        else if (strcmp(argv[i], "--simplify") == 0 && i + 1 < argc)
+        {
+            simplify_ratio = atof(argv[++i]);
+            if (!(simplify_ratio > 0.0 && simplify_ratio <= 1.0))
+            {
+                std::cerr << "--simplify takes a ratio of triangles in (0, 1]." << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+        {
+            if (!parse_sweep(argv[++i], thresholds))
+                return 1;
+        }
+        else if (argv[i][0] != '-')
+            fileName = argv[i];
+    }
+
+    cl_float min = 0.05;
+    device_normals = device_normals && !stream && !devices && !cpu;
+    bool sweeping = !thresholds.empty() && !stream && !devices && !cpu && !parity;
+    bool filtering = filter.criteria != 0 && !sweeping && !stream && !devices && !cpu && !parity;
+
+    // The levels of a sweep only come back whole
+    if (sweeping && output != OUTPUT_FULL)
+    {
+        std::cout << "A sweep reads back the whole triangle buffer, --output is ignored." << std::endl;
+        output = OUTPUT_FULL;
+    }
+
+    // So do the reasons of a filter, indices and bits would
+    // only say that a triangle was flagged
+    if (filtering && output != OUTPUT_FULL)
+    {
+        std::cout << "A filter reads back the whole triangle buffer, --output is ignored." << std::endl;
+        output = OUTPUT_FULL;
+    }
+
+    if (devices && !stream && !cpu)
+    {
+        if (!load_mesh(fileName))
+        {
+            std::cerr << "Failed to load File. May have failed to find it or it was not an .obj file." << std::endl;
+            return 1;
+        }
+        bool classified = classify_devices(min);
+        profile_report();
+        if (classified)
+            show_mesh(&argc, argv);
+        objl::AlignedFree(triangles_array);
+        objl::AlignedFree(verticles_array);
+        return classified ? 0 : 1;
+    }
+
+    // Create an OpenCL context on first available platform,
+    // classifying on the CPU without one
+    double start = profile_clock();
+    if (!cpu)
+    {
+        context = CreateContext();
+        if (context == NULL && (stream || parity))
+        {
+            std::cerr << "Failed to create OpenCL context." << std::endl;
+            return 1;
+        }
+        if (context == NULL)
+        {
+            std::cout << "No OpenCL context, classifying on the CPU." << std::endl;
+            cpu = true;
+        }
+    }
+
+    if (cpu)
+    {
+        if (!load_mesh(fileName))
+        {
+            std::cerr << "Failed to load File. May have failed to find it or it was not an .obj file." << std::endl;
+            return 1;
+        }
+        if (filter.criteria != 0 || !thresholds.empty() || stream || devices)
+            std::cout << "The CPU engine runs set_is_small on the whole file, other options are ignored." << std::endl;
+        classify_cpu(min);
+        profile_report();
+        show_mesh(&argc, argv);
+        objl::AlignedFree(triangles_array);
+        objl::AlignedFree(verticles_array);
+        return 0;
     }
 
     // Create a command-queue on the first device available
@@ -395,9 +3329,12 @@ int main(int argc, char* argv[])
         Cleanup(context, commandQueue, program, kernel, mem_objects);
         return 1;
     }
+    profile_host("create context", start);
 
     // Create OpenCL program from kernel.cl kernel source
+    start = profile_clock();
     program = CreateProgram(context, device, "kernel.cl");
+    profile_host("build program", start);
     if (program == NULL)
     {
         Cleanup(context, commandQueue, program, kernel, mem_objects);
@@ -405,7 +3342,8 @@ int main(int argc, char* argv[])
     }
 
     // Create OpenCL kernel
-    kernel = clCreateKernel(program, "set_is_small", NULL);
+    kernel = clCreateKernel(program, filtering ? "filter_triangles"
+        : sweeping ? "sweep_thresholds" : "set_is_small", NULL);
     if (kernel == NULL)
     {
         std::cerr << "Failed to create kernel" << std::endl;
@@ -413,61 +3351,69 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    // Initialize Loader
-    objl::Loader Loader;
+    if (stream)
+    {
+        bool streamed = classify_stream(context, commandQueue, device, kernel, mem_objects, fileName, min);
+        profile_report();
+        Cleanup(context, commandQueue, program, kernel, mem_objects);
+        return streamed ? 0 : 1;
+    }
 
     // Load .obj File
-    bool loadout = Loader.LoadFile("box_stack.obj");
-    if (!loadout)
+    if (!load_mesh(fileName))
     {
         std::cerr << "Failed to load File. May have failed to find it or it was not an .obj file." << std::endl;
         return 1;
     }
 
-    triangles_number = Loader.LoadedIndices.size() / 3;
-    verticles_number = Loader.LoadedVertices.size();
-    cl_uint4* _triangles_array = new cl_uint4[triangles_number];
-    triangles_array = _triangles_array;
-    cl_int idx = 0;
-    for (int i = 0; i < Loader.LoadedIndices.size(); i += 3)
-    {
-        idx = i / 3;
-        triangles_array[idx] =
-        {
-            Loader.LoadedIndices[i],
-            Loader.LoadedIndices[i + 1],
-            Loader.LoadedIndices[i + 2],
-            0
-        };
-    }
-    cl_float3* _verticles_array = new cl_float3[verticles_number * 3];
-    verticles_array = _verticles_array;
-    for (int i = 0; i < verticles_number; i++)
+    // Meshes larger than the device memory go through tiles
+    if (tiled || !fits_device(device))
     {
-        verticles_array[i] =
+        if (filtering || sweeping)
         {
-            Loader.LoadedVertices[i].Position.X,
-            Loader.LoadedVertices[i].Position.Y,
-            Loader.LoadedVertices[i].Position.Z
-        };
+            std::cout << "Tiles are classified with set_is_small, --filter and --sweep are ignored." << std::endl;
+            clReleaseKernel(kernel);
+            kernel = clCreateKernel(program, "set_is_small", NULL);
+        }
+
+        bool classified = kernel != NULL
+            && classify_tiled(context, commandQueue, device, kernel, mem_objects, min);
+        profile_report();
+        if (classified)
+            show_mesh(&argc, argv);
+
+        Cleanup(context, commandQueue, program, kernel, mem_objects);
+        objl::AlignedFree(triangles_array);
+        objl::AlignedFree(verticles_array);
+        return classified ? 0 : 1;
     }
 
-    cl_float min = 0.05;
-    
+    // The normals are left to the device when asked, falling
+    // back to the CPU
+    if (device_normals && !compute_normals_device(context, commandQueue, program))
+        compute_normals();
+
     // Create memory objects that will be used as arguments to
-    // kernel.  First create host memory arrays that will be
-    // used to store the arguments to the kernel
+    // kernel, using the host arrays in place when the device
+    // shares memory with the host
+    bool zeroCopy = is_zero_copy(device, triangles_array, verticles_array);
     if (!create_mem_objects(context, mem_objects, triangles_array, verticles_array,
-        &triangles_number, &verticles_number, &min))
+        &triangles_number, &verticles_number,
+        filtering ? (const void*)&filter : sweeping ? (const void*)thresholds.data() : (const void*)&min,
+        filtering ? sizeof(filter) : sweeping ? sizeof(cl_float) * thresholds.size() : sizeof(min), zeroCopy)
+        || (filtering && !create_filter_objects(context, kernel, mem_objects, filter))
+        || (sweeping && !create_sweep_objects(context, kernel, mem_objects, thresholds)))
     {
         Cleanup(context, commandQueue, program, kernel, mem_objects);
         return 1;
     }
 
     // Set the kernel arguments
+    cl_uint triangles_size = (cl_uint)triangles_number;
     errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), &mem_objects[0]);
     errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &mem_objects[1]);
     errNum |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &mem_objects[2]);
+    errNum |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &triangles_size);
     if (errNum != CL_SUCCESS)
     {
         std::cerr << "Error setting kernel arguments." << std::endl;
@@ -475,53 +3421,92 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    size_t globalWorkSize[1] = { triangles_number };
-    size_t localWorkSize[1] = { 1 };
+    // Pick the work-group size, tuning it on the first run on
+    // this device. Tuning needs the whole mesh on the device,
+    // so without zero-copy the first run uploads it up front
+    size_t localSize = 0;
+    start = profile_clock();
+    if (zeroCopy || !stored_local_size(device, kernel, &localSize))
+    {
+        if (!zeroCopy)
+        {
+            errNum = clEnqueueWriteBuffer(commandQueue, mem_objects[0], CL_TRUE,
+                0, sizeof(cl_uint4) * triangles_number, triangles_array, 0, NULL,
+                profile_event("upload triangles for tuning"));
+            errNum |= clEnqueueWriteBuffer(commandQueue, mem_objects[1], CL_TRUE,
+                0, sizeof(cl_float3) * verticles_number, verticles_array, 0, NULL,
+                profile_event("upload vertices for tuning"));
+            if (errNum != CL_SUCCESS)
+            {
+                std::cerr << "Error writing buffers." << std::endl;
+                Cleanup(context, commandQueue, program, kernel, mem_objects);
+                return 1;
+            }
+        }
+        localSize = tune_local_size(commandQueue, device, kernel, triangles_number);
+    }
+    profile_host("tune local size", start);
 
-    // Queue the kernel up for execution across the array
-    errNum = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL,
-        globalWorkSize, localWorkSize,
-        0, NULL, NULL);
-    if (errNum != CL_SUCCESS)
+    if ((filtering || sweeping)
+        && !reset_counts(commandQueue, mem_objects, filtering ? FILTER_REASONS : thresholds.size()))
     {
-        std::cerr << "Error queuing kernel for execution." << std::endl;
+        std::cerr << "Error writing buffers." << std::endl;
         Cleanup(context, commandQueue, program, kernel, mem_objects);
         return 1;
     }
 
-    // Read the output buffer back to the Host
-    errNum = clEnqueueReadBuffer(commandQueue, mem_objects[0], CL_TRUE,
-        0, triangles_number * sizeof(cl_float4), triangles_array,
-        0, NULL, NULL);
+    bool classified;
+    start = profile_clock();
+    if (zeroCopy)
+    {
+        classified = classify_mapped(commandQueue, kernel, mem_objects, localSize);
+    }
+    else
+    {
+        cl_command_queue transferQueue = clCreateCommandQueue(context, device, queue_properties(), NULL);
+        if (transferQueue == NULL)
+        {
+            std::cerr << "Failed to create transfer commandQueue" << std::endl;
+            Cleanup(context, commandQueue, program, kernel, mem_objects);
+            return 1;
+        }
+        classified = classify_pipelined(transferQueue, commandQueue, kernel, mem_objects,
+            localSize, output == OUTPUT_FULL);
+        clReleaseCommandQueue(transferQueue);
+
+        if (classified && output != OUTPUT_FULL)
+            classified = read_compacted(context, commandQueue, device, program, mem_objects[0], output);
+    }
 
-    if (errNum != CL_SUCCESS)
+    if (classified && filtering)
+        classified = report_filter(commandQueue, mem_objects, filter);
+    if (classified && sweeping)
+        classified = report_sweep(commandQueue, mem_objects, thresholds);
+    profile_host("classify", start);
+
+    if (!classified)
     {
-        std::cerr << "Error reading result buffer." << std::endl;
         Cleanup(context, commandQueue, program, kernel, mem_objects);
         return 1;
     }
 
     std::cout << "Executed program succesfully." << std::endl;
 
-    // initialize rendering with solid body
-    render_mode = true;
+    start = profile_clock();
+    if (parity && !check_parity(min))
+    {
+        Cleanup(context, commandQueue, program, kernel, mem_objects);
+        return 1;
+    }
+    if (parity)
+        profile_host("parity", start);
+    profile_report();
 
-    int window;
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_ALPHA | GLUT_DEPTH);
-    glutInitWindowSize(960, 720);
-    glutInitWindowPosition(0, 0);
-    window = glutCreateWindow("3d_check");
-    init();
-    glutDisplayFunc(display);
-    glutReshapeFunc(reshape);
-    glutSpecialFunc(arrow_keys);
-    glutKeyboardFunc(keyboard);
-    glutMainLoop();
+    show_mesh(&argc, argv);
 
     Cleanup(context, commandQueue, program, kernel, mem_objects);
-    delete[] triangles_array;
-    delete[] verticles_array;
+    objl::AlignedFree(triangles_array);
+    objl::AlignedFree(verticles_array);
     
     return 0;
 }
@@ -0,0 +1,519 @@
+// simplify.h - quadric error edge-collapse simplification on the CPU
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include "cpu_engine.h"
+
+// Spatial parts per thread of qem_simplify, each simplified
+// on its own with the vertices it shares with other parts
+// kept in place
+const size_t QEM_PARTS_PER_THREAD = 4;
+
+// Triangles a part has at least
+const size_t QEM_MIN_PART = 1 << 12;
+
+// Weight of the planes that hold mesh boundaries in place,
+// relative to the squared length of the boundary edge
+const double QEM_BOUNDARY_WEIGHT = 10.0;
+
+// Smallest cosine between the normals of a triangle before
+// and after a collapse, below it the collapse folds the mesh
+const double QEM_MIN_FLIP_COS = 0.2;
+
+///
+//  Symmetric 4x4 error quadric of the planes it sums, and
+//  the total weight of the planes
+//
+struct qem_quadric
+{
+    double a[10];   // a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+    double weight;
+    qem_quadric() : weight(0.0)
+    {
+        for (double& value : a)
+            value = 0.0;
+    }
+};
+
+///
+//  Add the plane n.p + d = 0, n of unit length, with the
+//  given weight
+//
+inline void qem_add_plane(qem_quadric& q, double nx, double ny, double nz, double d, double weight)
+{
+    q.a[0] += weight * nx * nx;
+    q.a[1] += weight * nx * ny;
+    q.a[2] += weight * nx * nz;
+    q.a[3] += weight * nx * d;
+    q.a[4] += weight * ny * ny;
+    q.a[5] += weight * ny * nz;
+    q.a[6] += weight * ny * d;
+    q.a[7] += weight * nz * nz;
+    q.a[8] += weight * nz * d;
+    q.a[9] += weight * d * d;
+    q.weight += weight;
+}
+
+inline void qem_add(qem_quadric& q, const qem_quadric& other)
+{
+    for (int i = 0; i < 10; i++)
+        q.a[i] += other.a[i];
+    q.weight += other.weight;
+}
+
+///
+//  Weighted sum of the squared distances of p to the planes
+//
+inline double qem_error(const qem_quadric& q, const double p[3])
+{
+    double x = p[0], y = p[1], z = p[2];
+    return q.a[0] * x * x + 2.0 * q.a[1] * x * y + 2.0 * q.a[2] * x * z + 2.0 * q.a[3] * x
+        + q.a[4] * y * y + 2.0 * q.a[5] * y * z + 2.0 * q.a[6] * y
+        + q.a[7] * z * z + 2.0 * q.a[8] * z + q.a[9];
+}
+
+///
+//  The point of least error, false when the planes do not
+//  pin one down
+//
+inline bool qem_optimum(const qem_quadric& q, double p[3])
+{
+    double m00 = q.a[0], m01 = q.a[1], m02 = q.a[2], m11 = q.a[4], m12 = q.a[5], m22 = q.a[7];
+    double c0 = m11 * m22 - m12 * m12, c1 = m02 * m12 - m01 * m22, c2 = m01 * m12 - m02 * m11;
+    double det = m00 * c0 + m01 * c1 + m02 * c2;
+    double trace = m00 + m11 + m22;
+    if (!(std::fabs(det) > 1e-9 * trace * trace * trace))
+        return false;
+
+    double b0 = -q.a[3], b1 = -q.a[6], b2 = -q.a[8];
+    p[0] = (c0 * b0 + c1 * b1 + c2 * b2) / det;
+    p[1] = (c1 * b0 + (m00 * m22 - m02 * m02) * b1 + (m01 * m02 - m00 * m12) * b2) / det;
+    p[2] = (c2 * b0 + (m01 * m02 - m00 * m12) * b1 + (m00 * m11 - m01 * m01) * b2) / det;
+    return std::isfinite(p[0]) && std::isfinite(p[1]) && std::isfinite(p[2]);
+}
+
+///
+//  A simplified mesh: triangles four indices apart with the
+//  index of the triangle of the input each one comes from
+//  fourth, vertices four floats apart as cl_float3 is, and
+//  the largest root mean square distance a collapse moved
+//  the surface by
+//
+struct qem_mesh
+{
+    std::vector<uint32_t> triangles;
+    std::vector<float> vertices;
+    double error;
+    qem_mesh() : error(0.0) {}
+};
+
+// A collapse of remove into keep, which moves to p
+struct qem_collapse
+{
+    double cost;
+    uint32_t keep, remove, keepVersion, removeVersion;
+    double p[3];
+    bool operator>(const qem_collapse& other) const { return cost > other.cost; }
+};
+
+///
+//  Simplify the triangles of one part down to target, by
+//  collapsing the edge of least error first. Vertices marked
+//  in locked stay where they are, the others of the part
+//  are moved in outVertices. The triangles left are added
+//  to kept with the global vertex indices and the source
+//  triangle. Returns the largest error of a collapse
+//
+inline double qem_simplify_part(const uint32_t* triangles, const std::vector<uint32_t>& part,
+    const float* vertices, const std::vector<uint8_t>& locked, size_t target,
+    float* outVertices, std::vector<uint32_t>& kept)
+{
+    // Local numbering of the vertices of the part
+    std::vector<uint32_t> verts;
+    verts.reserve(3 * part.size());
+    for (uint32_t t : part)
+    {
+        for (int k = 0; k < 3; k++)
+            verts.push_back(triangles[t * 4 + k]);
+    }
+    std::sort(verts.begin(), verts.end());
+    verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+    auto local = [&](uint32_t v) { return (uint32_t)(std::lower_bound(verts.begin(), verts.end(), v) - verts.begin()); };
+
+    size_t faceCount = part.size(), vertexCount = verts.size();
+    std::vector<uint32_t> faces(3 * faceCount);
+    std::vector<uint8_t> alive(faceCount, 1), dead(vertexCount, 0), fixed(vertexCount);
+    std::vector<uint32_t> version(vertexCount, 0);
+    std::vector<double> pos(3 * vertexCount);
+    std::vector<qem_quadric> quadrics(vertexCount);
+    std::vector<std::vector<uint32_t>> vertexFaces(vertexCount);
+
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        fixed[v] = locked[verts[v]];
+        for (int k = 0; k < 3; k++)
+            pos[3 * v + k] = vertices[(size_t)verts[v] * 4 + k];
+    }
+
+    // The plane of every triangle, weighted by its area,
+    // goes into the quadrics of its corners
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * faceCount);
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        uint32_t* corner = &faces[3 * f];
+        for (int k = 0; k < 3; k++)
+        {
+            corner[k] = local(triangles[part[f] * 4 + k]);
+            vertexFaces[corner[k]].push_back((uint32_t)f);
+        }
+
+        const double *a = &pos[3 * corner[0]], *b = &pos[3 * corner[1]], *c = &pos[3 * corner[2]];
+        double ux = b[0] - a[0], uy = b[1] - a[1], uz = b[2] - a[2];
+        double vx = c[0] - a[0], vy = c[1] - a[1], vz = c[2] - a[2];
+        double nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        double twice = std::sqrt(nx * nx + ny * ny + nz * nz);
+        if (twice > 0.0)
+        {
+            nx /= twice;
+            ny /= twice;
+            nz /= twice;
+            for (int k = 0; k < 3; k++)
+                qem_add_plane(quadrics[corner[k]], nx, ny, nz, -(nx * a[0] + ny * a[1] + nz * a[2]), 0.5 * twice);
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint64_t low = std::min(corner[k], corner[(k + 1) % 3]), high = std::max(corner[k], corner[(k + 1) % 3]);
+            edges.push_back(low << 32 | high);
+        }
+    }
+
+    // An edge of a single triangle is on a boundary, a plane
+    // through it square to the triangle keeps it in place
+    std::vector<uint64_t> sorted(edges);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            uint64_t edge = edges[3 * f + k];
+            auto range = std::equal_range(sorted.begin(), sorted.end(), edge);
+            if (range.second - range.first != 1)
+                continue;
+
+            uint32_t i = (uint32_t)(edge >> 32), j = (uint32_t)edge, o = faces[3 * f + (k + 2) % 3];
+            const double *a = &pos[3 * i], *b = &pos[3 * j], *c = &pos[3 * o];
+            double ex = b[0] - a[0], ey = b[1] - a[1], ez = b[2] - a[2];
+            double cx = c[0] - a[0], cy = c[1] - a[1], cz = c[2] - a[2];
+            double fx = ey * cz - ez * cy, fy = ez * cx - ex * cz, fz = ex * cy - ey * cx;
+            double nx = ey * fz - ez * fy, ny = ez * fx - ex * fz, nz = ex * fy - ey * fx;
+            double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+            if (!(length > 0.0))
+                continue;
+            nx /= length;
+            ny /= length;
+            nz /= length;
+            double weight = QEM_BOUNDARY_WEIGHT * (ex * ex + ey * ey + ez * ez);
+            double d = -(nx * a[0] + ny * a[1] + nz * a[2]);
+            qem_add_plane(quadrics[i], nx, ny, nz, d, weight);
+            qem_add_plane(quadrics[j], nx, ny, nz, d, weight);
+        }
+    }
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::priority_queue<qem_collapse, std::vector<qem_collapse>, std::greater<qem_collapse>> heap;
+    auto consider = [&](uint32_t a, uint32_t b)
+    {
+        if (fixed[a] && fixed[b])
+            return;
+        if (fixed[b])
+            std::swap(a, b);
+
+        qem_quadric q = quadrics[a];
+        qem_add(q, quadrics[b]);
+        qem_collapse collapse;
+        collapse.keep = a;
+        collapse.remove = b;
+        collapse.keepVersion = version[a];
+        collapse.removeVersion = version[b];
+
+        if (fixed[a] || !qem_optimum(q, collapse.p))
+        {
+            // The best of the ends and the middle
+            double candidates[3][3];
+            for (int k = 0; k < 3; k++)
+            {
+                candidates[0][k] = pos[3 * a + k];
+                candidates[1][k] = pos[3 * b + k];
+                candidates[2][k] = 0.5 * (pos[3 * a + k] + pos[3 * b + k]);
+            }
+            int best = 0;
+            for (int c = 1; c < (fixed[a] ? 1 : 3); c++)
+            {
+                if (qem_error(q, candidates[c]) < qem_error(q, candidates[best]))
+                    best = c;
+            }
+            for (int k = 0; k < 3; k++)
+                collapse.p[k] = candidates[best][k];
+        }
+        collapse.cost = std::max(0.0, qem_error(q, collapse.p));
+        heap.push(collapse);
+    };
+    for (uint64_t edge : sorted)
+        consider((uint32_t)(edge >> 32), (uint32_t)edge);
+
+    // Whether collapsing keeps the mesh manifold and no
+    // triangle around it turns over or vanishes
+    std::vector<uint32_t> around[2];
+    auto neighbours = [&](uint32_t v, std::vector<uint32_t>& out)
+    {
+        out.clear();
+        for (uint32_t f : vertexFaces[v])
+        {
+            if (!alive[f])
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                if (faces[3 * f + k] != v)
+                    out.push_back(faces[3 * f + k]);
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+    auto valid = [&](const qem_collapse& collapse)
+    {
+        uint32_t a = collapse.keep, b = collapse.remove;
+        neighbours(a, around[0]);
+        neighbours(b, around[1]);
+        size_t common = 0, shared = 0;
+        for (uint32_t v : around[0])
+            common += std::binary_search(around[1].begin(), around[1].end(), v);
+        for (uint32_t f : vertexFaces[a])
+        {
+            const uint32_t* c = &faces[3 * f];
+            shared += alive[f] && (c[0] == b || c[1] == b || c[2] == b);
+        }
+        if (shared == 0 || common != shared)
+            return false;
+
+        for (uint32_t v : { a, b })
+        {
+            for (uint32_t f : vertexFaces[v])
+            {
+                const uint32_t* c = &faces[3 * f];
+                if (!alive[f] || c[0] == (v == a ? b : a) || c[1] == (v == a ? b : a) || c[2] == (v == a ? b : a))
+                    continue;
+
+                const double* p[3];
+                double n[2][3];
+                for (int pass = 0; pass < 2; pass++)
+                {
+                    for (int k = 0; k < 3; k++)
+                        p[k] = pass == 1 && c[k] == v ? collapse.p : &pos[3 * c[k]];
+                    double ux = p[1][0] - p[0][0], uy = p[1][1] - p[0][1], uz = p[1][2] - p[0][2];
+                    double vx = p[2][0] - p[0][0], vy = p[2][1] - p[0][1], vz = p[2][2] - p[0][2];
+                    n[pass][0] = uy * vz - uz * vy;
+                    n[pass][1] = uz * vx - ux * vz;
+                    n[pass][2] = ux * vy - uy * vx;
+                }
+                double before = std::sqrt(n[0][0] * n[0][0] + n[0][1] * n[0][1] + n[0][2] * n[0][2]);
+                double after = std::sqrt(n[1][0] * n[1][0] + n[1][1] * n[1][1] + n[1][2] * n[1][2]);
+                double dot = n[0][0] * n[1][0] + n[0][1] * n[1][1] + n[0][2] * n[1][2];
+                if (!(after > 1e-12 * before) || dot < QEM_MIN_FLIP_COS * before * after)
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    size_t aliveFaces = faceCount;
+    double maxError = 0.0;
+    while (aliveFaces > target && !heap.empty())
+    {
+        qem_collapse collapse = heap.top();
+        heap.pop();
+        uint32_t a = collapse.keep, b = collapse.remove;
+        if (dead[a] || dead[b] || version[a] != collapse.keepVersion || version[b] != collapse.removeVersion)
+            continue;
+        if (!valid(collapse))
+            continue;
+
+        for (int k = 0; k < 3; k++)
+            pos[3 * a + k] = collapse.p[k];
+        double weight = quadrics[a].weight + quadrics[b].weight;
+        qem_add(quadrics[a], quadrics[b]);
+        dead[b] = 1;
+        version[a]++;
+        if (weight > 0.0)
+            maxError = std::max(maxError, std::sqrt(collapse.cost / weight));
+
+        for (uint32_t f : vertexFaces[b])
+        {
+            if (!alive[f])
+                continue;
+            uint32_t* c = &faces[3 * f];
+            if (c[0] == a || c[1] == a || c[2] == a)
+            {
+                alive[f] = 0;
+                aliveFaces--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                if (c[k] == b)
+                    c[k] = a;
+            }
+            vertexFaces[a].push_back(f);
+        }
+        vertexFaces[b].clear();
+        vertexFaces[a].erase(std::remove_if(vertexFaces[a].begin(), vertexFaces[a].end(),
+            [&](uint32_t f) { return !alive[f]; }), vertexFaces[a].end());
+
+        neighbours(a, around[0]);
+        for (uint32_t v : around[0])
+            consider(a, v);
+    }
+
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        if (!alive[f])
+            continue;
+        for (int k = 0; k < 3; k++)
+            kept.push_back(verts[faces[3 * f + k]]);
+        kept.push_back(part[f]);
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        if (fixed[v] || dead[v])
+            continue;
+        for (int k = 0; k < 3; k++)
+            outVertices[(size_t)verts[v] * 4 + k] = (float)pos[3 * v + k];
+    }
+    return maxError;
+}
+
+///
+//  Simplify a mesh, triangles four indices apart and
+//  vertices four floats apart, to about ratio of its
+//  triangles. The triangles are split into spatial parts by
+//  the Morton order of their centroids, with the axes
+//  interleaved starting from axis, and the parts are
+//  simplified in parallel with the vertices between them
+//  kept in place. Simplifying again with another axis moves
+//  those borders
+//
+inline void qem_simplify(qem_mesh& out, const uint32_t* triangles, size_t count,
+    const float* vertices, size_t vertexCount, double ratio, unsigned threads, int axis)
+{
+    size_t parts = threads > 1 ? std::max<size_t>(1, std::min<size_t>(threads * QEM_PARTS_PER_THREAD,
+        count / QEM_MIN_PART)) : 1;
+
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = (uint32_t)i;
+
+    if (parts > 1)
+    {
+        float lower[3] = { INFINITY, INFINITY, INFINITY }, upper[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                lower[k] = std::min(lower[k], vertices[v * 4 + k]);
+                upper[k] = std::max(upper[k], vertices[v * 4 + k]);
+            }
+        }
+
+        std::vector<uint32_t> codes(count);
+        cpu_parallel_for(count, CPU_GRAIN, threads, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                uint32_t cell[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    float centroid = (vertices[(size_t)triangles[i * 4] * 4 + k] + vertices[(size_t)triangles[i * 4 + 1] * 4 + k]
+                        + vertices[(size_t)triangles[i * 4 + 2] * 4 + k]) / 3.0f;
+                    float extent = upper[k] - lower[k];
+                    float unit = extent > 0.0f ? (centroid - lower[k]) / extent : 0.0f;
+                    cell[k] = (uint32_t)std::min(1023.0f, std::max(0.0f, unit * 1024.0f));
+                }
+                uint32_t code = 0;
+                for (int bit = 9; bit >= 0; bit--)
+                {
+                    for (int k = 0; k < 3; k++)
+                        code = code << 1 | ((cell[(axis + k) % 3] >> bit) & 1);
+                }
+                codes[i] = code;
+            }
+        });
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+    }
+
+    // Vertices used by more than one part stay in place
+    const uint32_t NONE = UINT32_MAX;
+    std::vector<uint32_t> owner(vertexCount, NONE);
+    std::vector<uint8_t> locked(vertexCount, 0);
+    std::vector<std::vector<uint32_t>> members(parts);
+    for (size_t part = 0; part < parts; part++)
+    {
+        size_t first = count * part / parts, last = count * (part + 1) / parts;
+        members[part].assign(order.begin() + first, order.begin() + last);
+        for (uint32_t t : members[part])
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = triangles[(size_t)t * 4 + k];
+                if (owner[v] == NONE)
+                    owner[v] = (uint32_t)part;
+                else if (owner[v] != part)
+                    locked[v] = 1;
+            }
+        }
+    }
+
+    std::vector<float> moved(vertices, vertices + vertexCount * 4);
+    std::vector<std::vector<uint32_t>> kept(parts);
+    std::vector<double> errors(parts, 0.0);
+    cpu_parallel_for(parts, 1, threads, [&](size_t first, size_t last)
+    {
+        for (size_t part = first; part < last; part++)
+        {
+            size_t target = (size_t)std::ceil(members[part].size() * ratio);
+            errors[part] = qem_simplify_part(triangles, members[part], vertices, locked, target,
+                moved.data(), kept[part]);
+        }
+    });
+
+    // Keep only the vertices the triangles left still use
+    std::vector<uint32_t> remap(vertexCount, NONE);
+    out.triangles.clear();
+    out.vertices.clear();
+    out.error = 0.0;
+    for (size_t part = 0; part < parts; part++)
+    {
+        out.error = std::max(out.error, errors[part]);
+        for (size_t i = 0; i < kept[part].size(); i += 4)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = kept[part][i + k];
+                if (remap[v] == NONE)
+                {
+                    remap[v] = (uint32_t)(out.vertices.size() / 4);
+                    out.vertices.insert(out.vertices.end(), moved.begin() + v * 4, moved.begin() + v * 4 + 4);
+                }
+                out.triangles.push_back(remap[v]);
+            }
+            out.triangles.push_back(kept[part][i + 3]);
+        }
+    }
+}